@@ -63,10 +63,51 @@ public:
     {
         return pthread_mutex_unlock(&m_mutex) == 0;
     }
+    /*获取互斥锁，和条件变量一起使用*/
+    pthread_mutex_t *get()
+    {
+        return &m_mutex;
+    }
 
 private:
     pthread_mutex_t m_mutex;
 };
+/*封装读写锁的类：读写锁允许多个线程同时读，写时独占，适合读多写少的临界资源*/
+class rwlocker
+{
+public:
+    /*创建并初始化读写锁*/
+    rwlocker()
+    {
+        if (pthread_rwlock_init(&m_rwlock, NULL) != 0)
+        {
+            throw std::exception();
+        }
+    }
+    /*销毁读写锁*/
+    ~rwlocker()
+    {
+        pthread_rwlock_destroy(&m_rwlock);
+    }
+    /*获取读锁*/
+    bool rdlock()
+    {
+        return pthread_rwlock_rdlock(&m_rwlock) == 0;
+    }
+    /*获取写锁*/
+    bool wrlock()
+    {
+        return pthread_rwlock_wrlock(&m_rwlock) == 0;
+    }
+    /*释放读锁或写锁*/
+    bool unlock()
+    {
+        return pthread_rwlock_unlock(&m_rwlock) == 0;
+    }
+
+private:
+    pthread_rwlock_t m_rwlock;
+};
 /*封装条件变量的类：条件变量通常与互斥锁一起使用，当资源可用时，用于通知其他线程来竞争资源*/
 class cond
 {
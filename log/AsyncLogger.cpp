@@ -30,7 +30,15 @@ void AsyncLogger::start()
 
 void AsyncLogger::stop()
 {
-    running_ = false;
+    {
+        //日志线程在持有锁时检查running_，不会错过唤醒
+        MutexLockGuard lock(mutex_);
+        if (!running_)
+        {
+            return;
+        }
+        running_ = false;
+    }
     //唤醒等待的条件变量
     cond_.notify_one();
     //回收线程
@@ -97,7 +105,8 @@ void AsyncLogger::threadFunc()
     FILE *stream = fopen(detail::getLogFileName().data(), "w");
     assert(stream);
 
-    while (running_)
+    bool running = true;
+    while (running)
     {
         assert(newBuffer1 && newBuffer1->size() == 0);
         assert(newBuffer2 && newBuffer2->size() == 0);
@@ -107,7 +116,8 @@ void AsyncLogger::threadFunc()
             //写缓冲区时，需要加锁
             std::unique_lock<std::mutex> lock(mutex_);
             // 如果buffers_为空，那么表示没有日志数据需要写入文件，那么就等待指定的时间
-            if (buffers_.empty()) // unusual usage!
+            // stop()之后不再等待，这一轮写出剩下的日志后退出
+            if (buffers_.empty() && running_) // unusual usage!
             {
                 cond_.wait_for(lock, std::chrono::seconds(flushInterval_));
             }
@@ -127,6 +137,7 @@ void AsyncLogger::threadFunc()
             {
                 nextBuffer_ = std::move(newBuffer2);
             }
+            running = running_;
         }
 
         assert(!buffersToWrite.empty());
@@ -174,5 +185,5 @@ void AsyncLogger::threadFunc()
         buffersToWrite.clear();
         fflush(stream);
     }
-    fflush(stream);
+    fclose(stream);
 }
@@ -30,7 +30,8 @@ namespace clog
 
     //运行异步日志线程
     void start();
-    //停止运行
+    //停止运行：写出所有缓冲区中的日志，关闭日志文件，回收日志线程；可以重复调用
+    //stop()之后写入的日志留在内存中，不会再写到文件
     void stop();
     //添加日志，前端在生成一条日志消息时，会调用AsyncLogging::append()
     void append(const char *logline, size_t len);
@@ -47,7 +48,7 @@ namespace clog
     using BufferPtr = BufferVector::value_type;
 
     const int flushInterval_; // 定期（flushInterval_秒）将缓冲区的数据写到文件中
-    bool running_;            // 运行写日志线程
+    bool running_;            // 运行写日志线程，由mutex_保护
     std::thread thread_;      // 日志线程
     std::mutex mutex_;
     std::condition_variable cond_;
@@ -1,7 +1,9 @@
 #include "Localtime.h"
 
 #include <sys/time.h>
+#include <time.h>
 #include <stdio.h>
+#include <string.h>
 
 namespace clog
 {
@@ -23,30 +25,68 @@ Localtime Localtime::now()
     return Localtime(seconds * detail::kMicroSecondsPerSecond + tv.tv_usec);
 }
 
+const size_t Localtime::kPrefixLen;
+const size_t Localtime::kFormattedLen;
+
 std::string Localtime::toFormattedString(bool showMicroSeconds) const
 {
     char buf[32] = {0};
-    time_t seconds = static_cast<time_t>(_microSecondsSinceEpoch / detail::kMicroSecondsPerSecond);
-    struct tm tm_time;
-    //获取对应的时间结构体
-    localtime_r(&seconds, &tm_time);
-    
-    if (showMicroSeconds)
+    static_assert(sizeof(buf) > Localtime::kFormattedLen, "buffer is too small for formatTo()");
+    formatTo(buf, sizeof(buf), showMicroSeconds);
+    return buf;
+}
+
+//按固定宽度写入十进制数字，不足的位补0
+static void formatDigits(char *p, int value, int width)
+{
+    for (int i = width - 1; i >= 0; i--)
     {
-        int microSeconds = static_cast<int>(_microSecondsSinceEpoch % detail::kMicroSecondsPerSecond);
-        snprintf(buf, sizeof(buf), "%4d%02d%02d %02d:%02d:%02d.%06d",
-                 tm_time.tm_year + 1900, tm_time.tm_mon + 1, tm_time.tm_mday,
-                 tm_time.tm_hour, tm_time.tm_min, tm_time.tm_sec,
-                 microSeconds);
+        p[i] = static_cast<char>('0' + value % 10);
+        value /= 10;
     }
-    else
+}
+
+int Localtime::formatTo(char *buf, size_t len, bool showMicroSeconds) const
+{
+    size_t n = showMicroSeconds ? kFormattedLen : kPrefixLen;
+    if (len <= n)
+    {
+        if (len > 0)
+            buf[0] = '\0';
+        return 0;
+    }
+    //同一秒内只格式化一次日期和时间：localtime_r每次都要检查时区，比格式化微秒慢得多
+    //宽度固定，不用snprintf，也不会被截断
+    thread_local time_t t_lastSecond = -1;
+    thread_local char t_lastPrefix[kPrefixLen + 1];
+    time_t seconds = static_cast<time_t>(_microSecondsSinceEpoch / detail::kMicroSecondsPerSecond);
+    if (seconds != t_lastSecond)
     {
-        snprintf(buf, sizeof(buf), "%04d%02d%02d %02d:%02d:%02d",
-                 tm_time.tm_year + 1900, tm_time.tm_mon + 1, tm_time.tm_mday,
-                 tm_time.tm_hour, tm_time.tm_min, tm_time.tm_sec);  
+        struct tm tm_time;
+        //获取对应的时间结构体
+        localtime_r(&seconds, &tm_time);
+        char *p = t_lastPrefix;
+        formatDigits(p, tm_time.tm_year + 1900, 4);
+        formatDigits(p + 4, tm_time.tm_mon + 1, 2);
+        formatDigits(p + 6, tm_time.tm_mday, 2);
+        p[8] = ' ';
+        formatDigits(p + 9, tm_time.tm_hour, 2);
+        p[11] = ':';
+        formatDigits(p + 12, tm_time.tm_min, 2);
+        p[14] = ':';
+        formatDigits(p + 15, tm_time.tm_sec, 2);
+        p[kPrefixLen] = '\0';
+        t_lastSecond = seconds;
     }
 
-    return buf;
+    memcpy(buf, t_lastPrefix, kPrefixLen);
+    if (showMicroSeconds)
+    {
+        buf[kPrefixLen] = '.';
+        formatDigits(buf + kPrefixLen + 1, static_cast<int>(_microSecondsSinceEpoch % detail::kMicroSecondsPerSecond), 6);
+    }
+    buf[n] = '\0';
+    return static_cast<int>(n);
 }
 
 }  // end of namespace clog
@@ -23,6 +23,12 @@ namespace clog
         static Localtime now();
         //转换为字符串
         std::string toFormattedString(bool showMicroSeconds = true) const;
+        //格式化到buf中，返回长度，不分配内存；每条日志都会调用
+        //len至少为kFormattedLen+1，否则只写入空字符串，返回0
+        int formatTo(char *buf, size_t len, bool showMicroSeconds = true) const;
+
+        static const size_t kPrefixLen = 17;                   //"20261019 08:00:30"
+        static const size_t kFormattedLen = kPrefixLen + 7;    //"20261019 08:00:30.194734"
 
         long long microSecondsSinceEpoch() const noexcept
         {
@@ -1,5 +1,7 @@
 #include "LogStream.h"
 
+#include <time.h>
+
 namespace clog
 {
 
@@ -13,29 +15,6 @@ namespace clog
         const char digitsHex[] = "0123456789ABCDEF";
         static_assert(sizeof(digitsHex) == 17, "size of digitsHex is not equal to 17");
 
-        // 把整形数快速转换成字符串，作者Matthew Wilson
-        template <typename T>
-        size_t convert(char buf[], T value)
-        {
-            T i = value;
-            char *p = buf;
-
-            do
-            {
-                int lsd = static_cast<int>(i % 10);
-                *p++ = zero[lsd];
-                i /= 10;
-            } while (i != 0);
-
-            if (value < 0)
-                *p++ = '-';
-            *p = '\0';
-
-            std::reverse(buf, p);
-
-            return p - buf;
-        }
-
         size_t convertHex(char buf[], uintptr_t value)
         {
             uintptr_t i = value;
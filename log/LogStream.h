@@ -25,6 +25,33 @@ namespace clog
         //获取日志文件名
         std::string getLogFileName();
 
+        //"9876543210123456789"的中间位置，zero[-9..9]对应每一位数字
+        extern const char *zero;
+
+        // 把整形数快速转换成字符串，作者Matthew Wilson
+        // 放在头文件中，HTTP响应头的Content-Length等也复用这个函数
+        template <typename T>
+        size_t convert(char buf[], T value)
+        {
+            T i = value;
+            char *p = buf;
+
+            do
+            {
+                int lsd = static_cast<int>(i % 10);
+                *p++ = zero[lsd];
+                i /= 10;
+            } while (i != 0);
+
+            if (value < 0)
+                *p++ = '-';
+            *p = '\0';
+
+            std::reverse(buf, p);
+
+            return p - buf;
+        }
+
         //Buffer类：用于缓存日志数据
         template <int SIZE>
         class FixBuffer
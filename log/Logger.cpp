@@ -134,8 +134,61 @@ public:
 
     //使用_stream输出日志
     Impl(LogLevel level, int savedErrno, const Logger::SourceFile &file, int line);
+
+    //每条日志都要创建一个Impl（其中LogStream有4KB的缓冲区），从线程局部的空闲链表中复用，不必每条日志都调用malloc
+    //Logger是临时对象，创建和销毁在同一个线程中
+    static void *operator new(size_t size);
+    static void operator delete(void *p);
 };
 
+namespace
+{
+    //线程局部的Impl空闲链表，只缓存少量对象：同一个线程同时存在的Logger很少超过一个
+    struct ImplCache
+    {
+        static const int kMaxCached = 4;
+        void *head = nullptr;
+        int count = 0;
+
+        ~ImplCache()
+        {
+            while (head)
+            {
+                void *next = *(void **)head;
+                ::operator delete(head);
+                head = next;
+            }
+        }
+    };
+    thread_local ImplCache t_implCache;
+}
+
+void *Logger::Impl::operator new(size_t size)
+{
+    ImplCache &cache = t_implCache;
+    if (cache.head)
+    {
+        void *p = cache.head;
+        cache.head = *(void **)p;
+        cache.count--;
+        return p;
+    }
+    return ::operator new(size);
+}
+
+void Logger::Impl::operator delete(void *p)
+{
+    ImplCache &cache = t_implCache;
+    if (cache.count >= ImplCache::kMaxCached)
+    {
+        ::operator delete(p);
+        return;
+    }
+    *(void **)p = cache.head;
+    cache.head = p;
+    cache.count++;
+}
+
 Logger::Impl::Impl(LogLevel level, int savedErrno, const Logger::SourceFile &file, int line)
     : _level(level),
       _file(file),
@@ -145,7 +198,11 @@ Logger::Impl::Impl(LogLevel level, int savedErrno, const Logger::SourceFile &fil
 {
     //流对象的内部有一个buffer，保存这些数据
     _stream << tid << ' ';
-    _stream << _time.toFormattedString() << ' ';
+    char timebuf[32];
+    static_assert(sizeof(timebuf) > Localtime::kFormattedLen, "timebuf is too small for formatTo()");
+    int timelen = _time.formatTo(timebuf, sizeof(timebuf));
+    _stream.append(timebuf, timelen);
+    _stream << ' ';
     _stream << T(LogLevelName[_level], 6);
 
     if (savedErrno)
@@ -228,12 +285,10 @@ void Logger::setConcurrentMode()
 //     logger.stop();
 // }
 
-// void Logger::finishConcurrent()
-// {
-//     _runing = false;
-//     queue.put("\0");
-//     logThread.join();
-// }
+void Logger::finishConcurrent()
+{
+    logger.stop();
+}
 
 // void Logger::setOutput(Logger::OutputFunc output) noexcept
 // {
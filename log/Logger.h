@@ -80,7 +80,8 @@ namespace clog
         //启动异步模式
         static void setConcurrentMode();
 
-        //static void finishConcurrent();
+        //结束异步模式：日志线程写出所有缓冲区后退出，进程退出前调用
+        static void finishConcurrent();
 
         //void (*)(const std::string &)函数指针取别名为OutputFunc
         //using OutputFunc = void (*)(const std::string &);
@@ -12,28 +12,179 @@
 #include <arpa/inet.h>
 #include <string.h>
 #include <fcntl.h>
+#include <sys/resource.h>
+#include <algorithm>
 #include <string>
+#include <vector>
 #include <thread>
 #include "processpool.h"
 #include "http.h"
-#define SERVERPORT "7777"
+#include "../utils/Listener.h"
+#include "../utils/Config.h"
 
+//注册所有配置项：默认值 → --config指定的文件 → 命令行--key=value，见utils/Config.h
+//worker数按CPU核数、每个worker的连接数组按RLIMIT_NOFILE计算默认值，标记为可热加载的项在SIGHUP时生效
+static void init_config()
+{
+    int cores = std::max(1u, std::thread::hardware_concurrency());
+    //fd不会超过RLIMIT_NOFILE，更大的连接数组只会浪费虚拟地址
+    int nofile = 65535;
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+        nofile = (int)std::min<rlim_t>(rl.rlim_cur, 1 << 22);
+
+    Config &conf = Config::instance();
+    conf.add_int("port", 7777, 1, 65535, false, "监听端口");
+    conf.add_string("doc_root", "/var/www/html", false, "网站根路径");
+    conf.add_int("min_workers", 2, 1, 64, false, "最少的worker进程数");
+    conf.add_int("max_workers", std::min(std::max(cores, 2), 64), 1, 64, false, "最多的worker进程数，默认等于CPU核数");
+    conf.add_string("dispatch", "pass_fd", false, "分发连接的方式：master accept后传递fd，或者通知worker自己accept", "pass_fd|accept_token");
+    conf.add_int("worker_connections", nofile, 16, 1 << 22, false, "每个worker同时服务的连接数上限，默认等于RLIMIT_NOFILE");
+    conf.add_int("pin_cpu", 1, 0, 1, false, "把worker绑定到CPU上");
+    conf.add_string("irq_cpus", "", false, "处理网卡中断、不绑定worker的CPU，例如0-1,4");
+    conf.add_int("event_batch", 1024, 1, 1 << 16, false, "每次epoll_wait最多取出的事件数");
+    conf.add_int("io_budget", 256, 1, 1 << 16, true, "每轮最多接受、读取、发送的连接数，三者分别计算");
+    conf.add_int("write_quantum", 256 * 1024, 4096, 1 << 30, true, "一次Write()最多发送的字节数");
+    conf.add_int("idle_timeout", 3 * TIMESLOT, TIMESLOT, 86400, true, "连接空闲超过这么多秒后关闭");
+    conf.add_int("backlog", 1024, 1, 65535, false, "listen()的backlog，上限是net.core.somaxconn");
+    conf.add_int("defer_accept", 1, 0, 3600, false, "TCP_DEFER_ACCEPT的秒数，0表示关闭");
+    conf.add_int("fastopen", 256, 0, 65535, false, "TCP_FASTOPEN的队列长度，0表示关闭");
+    conf.add_int("nodelay", 1, 0, 1, false, "关闭Nagle算法");
+    conf.add_int("quickack", 0, 0, 1, true, "新连接立即确认第一个请求");
+}
 
+//启动时检查配置项之间的关系，出错时返回false
+static bool check_config(std::string &err)
+{
+    Config &conf = Config::instance();
+    struct stat st;
+    const std::string &root = conf.get_string("doc_root");
+    if (stat(root.c_str(), &st) < 0 || !S_ISDIR(st.st_mode))
+    {
+        err = "config: doc_root " + root + " is not a directory";
+        return false;
+    }
+    if (conf.get_int("min_workers") > conf.get_int("max_workers"))
+    {
+        err = "config: min_workers must not be larger than max_workers";
+        return false;
+    }
+    return true;
+}
+
+//可以热加载的项，启动和SIGHUP时都调用
+static void apply_reloadable(ReactorBudget &budget)
+{
+    Config &conf = Config::instance();
+    budget.accepts = budget.reads = budget.writes = conf.get_int("io_budget");
+    HTTPConn::m_write_quantum = conf.get_int("write_quantum");
+    HTTPConn::m_idle_timeout = conf.get_int("idle_timeout");
+    Listener::instance().options().quickack = conf.get_int("quickack");
+}
+
+//SIGHUP：master和每个worker各自重新读取配置，已有的连接不受影响
+static bool reload_config(ReactorBudget &budget)
+{
+    std::string err;
+    std::vector<std::string> changed;
+    if (!Config::instance().reload(err, changed))
+    {
+        fprintf(stderr, "%d: %s\n", getpid(), err.c_str());
+        return false;
+    }
+    for (const std::string &key : changed)
+    {
+        printf("%d: reload %s\n", getpid(), key.c_str());
+    }
+    apply_reloadable(budget);
+    return true;
+}
 
 int main(int argc, char const *argv[])
 {
+    init_config();
+    //httpserver_processpool --metrics [--port=N]：输出正在运行的服务器的指标后退出
+    bool show_metrics = argc > 1 && strcmp(argv[1], "--metrics") == 0;
+    if (show_metrics)
+    {
+        argc--;
+        argv++;
+    }
+    Config &conf = Config::instance();
+    std::string err;
+    if (!conf.load(argc, argv, err) || (!show_metrics && !check_config(err)))
+    {
+        //--help时err为空
+        if (!err.empty())
+            fprintf(stderr, "%s\n", err.c_str());
+        return err.empty() ? 0 : 1;
+    }
+    if (show_metrics)
+    {
+        char name[64];
+        metrics_shm_name(conf.get_int("port"), name, sizeof(name));
+        const MetricsPage *page = metrics_attach(name);
+        if (!page)
+        {
+            fprintf(stderr, "no metrics found at %s, is the server running?\n", name);
+            return 1;
+        }
+        fputs(metrics_render(page).c_str(), stdout);
+        return 0;
+    }
+    //字符串保存在Config中，doc_root不能热加载，指针一直有效
+    doc_root = conf.get_string("doc_root").c_str();
+
+    ListenOptions &listen_opt = Listener::instance().options();
+    listen_opt.backlog = conf.get_int("backlog");
+    listen_opt.defer_accept = conf.get_int("defer_accept");
+    listen_opt.fastopen = conf.get_int("fastopen");
+    listen_opt.nodelay = conf.get_int("nodelay");
+
     int lfd;
-    struct sockaddr_in laddr;
-    lfd = socket(AF_INET, SOCK_STREAM, 0);
-    laddr.sin_family = AF_INET;
-    laddr.sin_port = htons(atoi(SERVERPORT));
-    inet_pton(AF_INET, "0.0.0.0", &laddr.sin_addr);
-    int val = 1;
-    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
-    bind(lfd, (struct sockaddr *)&laddr, sizeof(laddr));
-    listen(lfd, 128);
-    ProcessPool<HTTPConn> &pool = ProcessPool<HTTPConn>::create(lfd, 2, 10);
+    int ready_fd = -1;
+    //热升级：旧的master通过LISTEN_FD把监听socket交给新进程，不需要重新bind，按新进程的配置重新设置选项
+    const char *listen_fd = getenv("LISTEN_FD");
+    if (listen_fd)
+    {
+        lfd = atoi(listen_fd);
+        unsetenv("LISTEN_FD");
+        fcntl(lfd, F_SETFD, FD_CLOEXEC);
+        printf("inherit listen fd %d\n", lfd);
+        //旧的master等待的管道交给进程池，第一个worker就绪后才通知，之前的任何失败都让旧的master超时后继续服务
+        const char *ready = getenv("UPGRADE_READY_FD");
+        if (ready)
+        {
+            ready_fd = atoi(ready);
+            unsetenv("UPGRADE_READY_FD");
+            fcntl(ready_fd, F_SETFD, FD_CLOEXEC);
+        }
+        if (!Listener::instance().adopt(lfd))
+        {
+            return 1;
+        }
+    }
+    else
+    {
+        //backlog、TCP_DEFER_ACCEPT、TCP_FASTOPEN等选项见utils/Listener.h
+        lfd = Listener::instance().open("0.0.0.0", conf.get_int("port"));
+        if (lfd < 0)
+        {
+            return 1;
+        }
+    }
+    const std::string &irq_cpus = conf.get_string("irq_cpus");
+    CpuPlacement::instance().configure(conf.get_int("pin_cpu"), irq_cpus.empty() ? nullptr : irq_cpus.c_str());
+    ReactorBudget budget;
+    budget.events = conf.get_int("event_batch");
+    budget.connections = conf.get_int("worker_connections");
+    apply_reloadable(budget);
+    DISPATCH_MODE mode = conf.get_string("dispatch") == "pass_fd" ? PASS_FD : ACCEPT_TOKEN;
+    ProcessPool<HTTPConn> &pool = ProcessPool<HTTPConn>::create(lfd, conf.get_int("min_workers"), conf.get_int("max_workers"), mode, budget, ready_fd);
+    //worker在create()中fork，之后各自设置SIGHUP的处理函数
+    pool.set_reload(reload_config);
+    pool.set_exec(argc, argv);
     pool.run();
     close(lfd);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,133 @@
+/**
+ * @author: fenghaze
+ * @date: 2026/10/19 18:05
+ * @desc: worker进程的CPU绑定
+ * 从进程允许使用的CPU中去掉处理网卡中断的CPU，按worker的槽位依次绑定
+ * 连接的SO_INCOMING_CPU和worker绑定的CPU一致时，软中断、accept和请求处理都在同一个核上
+ */
+
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+class CpuPlacement
+{
+public:
+    static CpuPlacement &instance()
+    {
+        static CpuPlacement mInstance;
+        return mInstance;
+    }
+
+    //enable为false时不绑定；irq_cpus是处理网卡中断的CPU列表，例如"0,2-3"，可以为nullptr
+    //必须在创建进程池之前调用
+    void configure(bool enable, const char *irq_cpus);
+
+    bool enabled() const { return !m_cpus.empty(); }
+
+    //第idx个worker使用的CPU，没有开启绑定时返回-1
+    int cpu_for(int idx) const
+    {
+        return m_cpus.empty() ? -1 : m_cpus[idx % m_cpus.size()];
+    }
+
+    //把调用进程绑定到cpu上
+    static bool pin(int cpu)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) < 0)
+        {
+            perror("sched_setaffinity()");
+            return false;
+        }
+        return true;
+    }
+
+private:
+    CpuPlacement() {}
+
+    //解析"0,2-3"格式的CPU列表
+    static void parse_list(const char *list, cpu_set_t &set);
+
+private:
+    std::vector<int> m_cpus; //可以绑定worker的CPU
+};
+
+void CpuPlacement::configure(bool enable, const char *irq_cpus)
+{
+    m_cpus.clear();
+    if (!enable)
+    {
+        return;
+    }
+    cpu_set_t allowed, irq;
+    CPU_ZERO(&irq);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+    {
+        perror("sched_getaffinity()");
+        return;
+    }
+    if (irq_cpus)
+    {
+        parse_list(irq_cpus, irq);
+    }
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (CPU_ISSET(cpu, &allowed) && !CPU_ISSET(cpu, &irq))
+        {
+            m_cpus.push_back(cpu);
+        }
+    }
+    //所有CPU都在处理中断时，依然使用全部CPU
+    if (m_cpus.empty())
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, &allowed))
+            {
+                m_cpus.push_back(cpu);
+            }
+        }
+    }
+}
+
+void CpuPlacement::parse_list(const char *list, cpu_set_t &set)
+{
+    const char *p = list;
+    while (*p)
+    {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p)
+        {
+            break;
+        }
+        long last = first;
+        p = end;
+        if (*p == '-')
+        {
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+        {
+            if (cpu >= 0)
+            {
+                CPU_SET(cpu, &set);
+            }
+        }
+        if (*p == ',')
+        {
+            ++p;
+        }
+    }
+}
+
+#endif // AFFINITY_H
@@ -0,0 +1,166 @@
+/**
+ * @author: fenghaze
+ * @date: 2026/10/19 18:40
+ * @desc: worker进程的内存池
+ * ObjectPool：按块mmap的定长对象池，释放的对象挂在空闲链表上复用，用于定时器节点
+ * FdArena：按fd下标访问的连接数组，预留整块虚拟地址但不预先分配物理内存，第一次使用某个fd时才构造对象
+ * 两者都用MAP_NORESERVE映射并标记MADV_HUGEPAGE，只在worker进程中创建，fork不会复制它们
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <new>
+#include <utility>
+#include <stdint.h>
+#include <stdio.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <vector>
+
+//映射一块匿名内存：不预留交换空间，允许使用透明大页
+inline void *arena_map(size_t size)
+{
+    void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr == MAP_FAILED)
+    {
+        perror("mmap()");
+        return nullptr;
+    }
+    madvise(addr, size, MADV_HUGEPAGE);
+    return addr;
+}
+
+template <typename T>
+class ObjectPool
+{
+public:
+    ObjectPool() : m_free(nullptr), m_next(nullptr), m_end(nullptr) {}
+    ~ObjectPool()
+    {
+        for (void *chunk : m_chunks)
+        {
+            munmap(chunk, CHUNK_SIZE);
+        }
+    }
+
+    template <typename... Args>
+    T *create(Args &&... args);
+
+    void destroy(T *obj);
+
+private:
+    //空闲的槽位复用对象的内存保存链表指针
+    union Slot
+    {
+        Slot *next;
+        alignas(T) char data[sizeof(T)];
+    };
+    static const size_t CHUNK_SIZE = 2 * 1024 * 1024; //每次映射2MB，正好一个大页
+
+    Slot *m_free;                //空闲链表
+    Slot *m_next;                //当前块中还没有用过的位置
+    Slot *m_end;                 //当前块的末尾
+    std::vector<void *> m_chunks; //所有映射的块
+};
+
+template <typename T>
+template <typename... Args>
+T *ObjectPool<T>::create(Args &&... args)
+{
+    Slot *slot = m_free;
+    if (slot)
+    {
+        m_free = slot->next;
+    }
+    else
+    {
+        if (m_next == m_end)
+        {
+            void *chunk = arena_map(CHUNK_SIZE);
+            if (!chunk)
+            {
+                return nullptr;
+            }
+            m_chunks.push_back(chunk);
+            m_next = static_cast<Slot *>(chunk);
+            m_end = m_next + CHUNK_SIZE / sizeof(Slot);
+        }
+        slot = m_next++;
+    }
+    return new (slot->data) T(std::forward<Args>(args)...);
+}
+
+template <typename T>
+void ObjectPool<T>::destroy(T *obj)
+{
+    if (!obj)
+    {
+        return;
+    }
+    obj->~T();
+    Slot *slot = reinterpret_cast<Slot *>(obj);
+    slot->next = m_free;
+    m_free = slot;
+}
+
+template <typename T>
+class FdArena
+{
+public:
+    explicit FdArena(int capacity);
+    ~FdArena();
+
+    //已经构造过的对象
+    T &operator[](int fd)
+    {
+        assert(fd >= 0 && fd < m_capacity && constructed(fd));
+        return m_objs[fd];
+    }
+
+    //第一次使用fd时构造对象，之后直接返回，关闭连接后对象留在原地给下一个相同的fd复用
+    T &get(int fd)
+    {
+        assert(fd >= 0 && fd < m_capacity);
+        if (!constructed(fd))
+        {
+            new (&m_objs[fd]) T();
+            m_bits[fd >> 6] |= 1ULL << (fd & 63);
+        }
+        return m_objs[fd];
+    }
+
+    bool constructed(int fd) const
+    {
+        return m_bits[fd >> 6] & (1ULL << (fd & 63));
+    }
+
+    int capacity() const { return m_capacity; }
+
+private:
+    int m_capacity;
+    T *m_objs;
+    std::vector<uint64_t> m_bits; //每个fd一位，标记对象是否已经构造
+};
+
+template <typename T>
+FdArena<T>::FdArena(int capacity) : m_capacity(capacity), m_bits((capacity + 63) / 64, 0)
+{
+    m_objs = static_cast<T *>(arena_map(sizeof(T) * capacity));
+    assert(m_objs);
+}
+
+template <typename T>
+FdArena<T>::~FdArena()
+{
+    for (int fd = 0; fd < m_capacity; fd++)
+    {
+        if (constructed(fd))
+        {
+            m_objs[fd].~T();
+        }
+    }
+    munmap(m_objs, sizeof(T) * m_capacity);
+}
+
+#endif // ARENA_H
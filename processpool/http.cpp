@@ -62,6 +62,14 @@ void modfd(int epfd, int fd, int event)
     epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
 }
 
+//排空标志
+bool HTTPConn::m_draining = false;
+//进程池没有设置指标页时，计数写到这里
+static WorkerMetrics unused_metrics;
+WorkerMetrics *HTTPConn::m_metrics = &unused_metrics;
+const MetricsPage *HTTPConn::m_metrics_page = nullptr;
+int HTTPConn::m_write_quantum = 256 * 1024;
+int HTTPConn::m_idle_timeout = 3 * TIMESLOT;
 //用户数
 //int HTTPConn::m_user_count = 0;
 //epoll句柄
@@ -97,6 +105,10 @@ void HTTPConn::init()
     m_checked_idx = 0;
     m_read_idx = 0;
     m_write_idx = 0;
+    bytes_to_send = 0;
+    bytes_have_send = 0;
+    m_file_address = 0;
+    m_body_address = 0;
     memset(m_read_buf, '\0', READ_BUFFER_SIZE);
     memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
     memset(m_real_file, '\0', FILENAME_LEN);
@@ -107,8 +119,10 @@ void HTTPConn::close_conn(bool real_close)
 {
     if (real_close && (m_sockfd != -1))
     {
+        unmap();
         removefd(m_epollfd, m_sockfd);
         m_sockfd = -1;
+        m_write_idx = 0;
         m_user_count--;
     }
 }
@@ -122,6 +136,15 @@ void HTTPConn::process()
         modfd(m_epollfd, m_sockfd, EPOLLIN);
         return;
     }
+    if (read_ret == BAD_REQUEST)
+    {
+        metrics_add(m_metrics->parse_errors);
+    }
+    //排空期间不再保持连接
+    if (m_draining)
+    {
+        m_linger = false;
+    }
     bool write_ret = process_write(read_ret);
     if (!write_ret)
     {
@@ -140,6 +163,11 @@ bool HTTPConn::Read()
     }
 
     int bytes_read = 0;
+    //新请求的第一次读取，开始计时
+    if (m_read_idx == 0)
+    {
+        m_request_start = metrics_now_us();
+    }
     //循环读取客户数据
     while (1)
     {
@@ -160,6 +188,7 @@ bool HTTPConn::Read()
         m_read_idx += bytes_read;
         return true;
     }
+    return true;
 }
 //主状态机，解析HTTP请求
 HTTPConn::HTTP_CODE HTTPConn::process_read()
@@ -171,7 +200,6 @@ HTTPConn::HTTP_CODE HTTPConn::process_read()
     {
         text = get_line();
         m_start_line = m_checked_idx;
-        printf("got 1 http line: %s\n", text);
         switch (m_check_state)
         {
         case CHECK_STATE_REQUESTLINE:
@@ -212,6 +240,7 @@ HTTPConn::HTTP_CODE HTTPConn::process_read()
         }
         }
     }
+    return NO_REQUEST;
 }
 
 //从状态机，解析请求体的每一行：直到读取到回车换行符时，才是完整的一行
@@ -332,10 +361,6 @@ HTTPConn::HTTP_CODE HTTPConn::parse_headers(char *text)
         text += strspn(text, " ");
         m_host = text;
     }
-    else
-    {
-        printf("oop!unknow headers\n");
-    }
     return NO_REQUEST;
 }
 
@@ -355,6 +380,10 @@ HTTPConn::HTTP_CODE HTTPConn::parse_content(char *text)
 如果目标文件存在、对所有用户可读，且不是目录，则使用mmap将其映射到内存地址m_file_address处，并告诉调用者获取文件成功*/
 HTTPConn::HTTP_CODE HTTPConn::do_request()
 {
+    if (m_metrics_page && strcmp(m_url, "/metrics") == 0)
+    {
+        return METRICS_REQUEST;
+    }
     strcpy(m_real_file, doc_root);
     int len = strlen(doc_root);
     strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
@@ -390,8 +419,7 @@ void HTTPConn::unmap()
 bool HTTPConn::Write()
 {
     int temp = 0;
-    int bytes_have_send = 0;
-    int bytes_to_send = m_write_idx;
+    int sent = 0; //本次调用已经发送的字节数
     if (bytes_to_send == 0)
     {
         modfd(m_epollfd, m_sockfd, EPOLLIN);
@@ -400,6 +428,12 @@ bool HTTPConn::Write()
     }
     while (1)
     {
+        /*大文件分多轮发送：ONESHOT重新注册EPOLLOUT后，socket可写时会在下一轮epoll_wait中再次返回*/
+        if (sent >= m_write_quantum)
+        {
+            modfd(m_epollfd, m_sockfd, EPOLLOUT);
+            return true;
+        }
         temp = writev(m_sockfd, m_iv, m_iv_count);
         if (temp <= -1)
         {
@@ -410,14 +444,30 @@ bool HTTPConn::Write()
                 modfd(m_epollfd, m_sockfd, EPOLLOUT);
                 return true;
             }
+            metrics_add(m_metrics->write_errors);
             unmap();
             return false;
         }
+        metrics_add(m_metrics->bytes_out, temp);
+        sent += temp;
         bytes_to_send -= temp;
         bytes_have_send += temp;
-        if (bytes_to_send <= bytes_have_send)
+        /*writev可能只发送了一部分，调整两个IO向量，下次从未发送的位置继续*/
+        if (bytes_have_send < m_write_idx)
+        {
+            m_iv[0].iov_base = m_write_buf + bytes_have_send;
+            m_iv[0].iov_len = m_write_idx - bytes_have_send;
+        }
+        else if (m_iv_count == 2)
+        {
+            m_iv[0].iov_len = 0;
+            m_iv[1].iov_base = m_body_address + (bytes_have_send - m_write_idx);
+            m_iv[1].iov_len = bytes_to_send;
+        }
+        if (bytes_to_send <= 0)
         {
             /*发送HTTP响应成功，根据HTTP请求中的Connection字段决定是否立即关闭连接*/
+            m_metrics->observe(metrics_now_us() - m_request_start);
             unmap();
             if (m_linger)
             {
@@ -454,13 +504,12 @@ bool HTTPConn::add_response(const char *format, ...)
 }
 bool HTTPConn::add_status_line(int status, const char *title)
 {
-    return add_response("%s%d%s\r\n", "HTTP/1.1", status, title);
+    m_metrics->status_code(status);
+    return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
 }
 bool HTTPConn::add_headers(int content_len)
 {
-    add_content_length(content_len);
-    add_linger();
-    add_blank_line();
+    return add_content_length(content_len) && add_linger() && add_blank_line();
 }
 bool HTTPConn::add_content_length(int content_len)
 {
@@ -524,6 +573,21 @@ bool HTTPConn::process_write(HTTP_CODE ret)
         }
         break;
     }
+    case METRICS_REQUEST:
+    {
+        m_body = metrics_render(m_metrics_page);
+        add_status_line(200, ok_200_title);
+        add_response("Content-Type:%s\r\n", "text/plain; version=0.0.4");
+        add_headers(m_body.size());
+        m_body_address = &m_body[0];
+        m_iv[0].iov_base = m_write_buf;
+        m_iv[0].iov_len = m_write_idx;
+        m_iv[1].iov_base = m_body_address;
+        m_iv[1].iov_len = m_body.size();
+        m_iv_count = 2;
+        bytes_to_send = m_write_idx + m_body.size();
+        return true;
+    }
     case FILE_REQUEST:
     {
         add_status_line(200, ok_200_title);
@@ -532,9 +596,11 @@ bool HTTPConn::process_write(HTTP_CODE ret)
             add_headers(m_file_stat.st_size);
             m_iv[0].iov_base = m_write_buf;
             m_iv[0].iov_len = m_write_idx;
-            m_iv[1].iov_base = m_file_address;
+            m_body_address = m_file_address;
+            m_iv[1].iov_base = m_body_address;
             m_iv[1].iov_len = m_file_stat.st_size;
             m_iv_count = 2;
+            bytes_to_send = m_write_idx + m_file_stat.st_size;
             return true;
         }
         else
@@ -546,6 +612,7 @@ bool HTTPConn::process_write(HTTP_CODE ret)
                 return false;
             }
         }
+        break;
     }
     default:
     {
@@ -555,5 +622,6 @@ bool HTTPConn::process_write(HTTP_CODE ret)
     m_iv[0].iov_base = m_write_buf;
     m_iv[0].iov_len = m_write_idx;
     m_iv_count = 1;
+    bytes_to_send = m_write_idx;
     return true;
 }
\ No newline at end of file
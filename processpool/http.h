@@ -26,11 +26,16 @@
 #include <stdarg.h>
 #include <errno.h>
 #include <sys/uio.h>
+#include <string>
 #include "listClock.h"
+#include "metrics.h"
 #include "../lock/locker.h"
 
 class ListNode;
 
+/*网站的根目录，在http.cpp中定义，启动时按配置修改*/
+extern const char *doc_root;
+
 class HTTPConn
 {
 
@@ -71,7 +76,8 @@ public:
         FORBIDDEN_REQUEST,
         FILE_REQUEST,
         INTERNAL_ERROR,
-        CLOSED_CONNECTION
+        CLOSED_CONNECTION,
+        METRICS_REQUEST
     };
     /*行的读取状态*/
     enum LINE_STATUS
@@ -82,7 +88,7 @@ public:
     };
 
 public:
-    HTTPConn() {}
+    HTTPConn() : m_sockfd(-1), m_node(nullptr), m_deferred(0) {}
     ~HTTPConn() {}
 
     //初始化客户连接
@@ -95,6 +101,10 @@ public:
     bool Read();
     //非阻塞写
     bool Write();
+    //是否有已经生成、还没有发送完的响应
+    bool responding() const { return m_write_idx > 0; }
+    //连接上没有正在读取的请求，也没有正在发送的响应
+    bool idle() const { return m_read_idx == 0 && m_write_idx == 0; }
 
 private:
     //初始化连接，私有方法
@@ -126,12 +136,23 @@ public:
     int m_epollfd;
     /*统计用户数量*/
     int m_user_count;
+    /*进程正在排空：响应发送完之后关闭连接，不再保持keep-alive*/
+    static bool m_draining;
+    /*当前进程的计数，和所有进程共享的指标页（用于/metrics）*/
+    static WorkerMetrics *m_metrics;
+    static const MetricsPage *m_metrics_page;
+    /*一次Write()最多发送的字节数，超过后重新注册EPOLLOUT，让同一轮的其他连接先处理*/
+    static int m_write_quantum;
+    /*连接空闲超过这么多秒后由定时器关闭*/
+    static int m_idle_timeout;
 
     /*该HTTP连接的socket和对方的socket地址*/
     int m_sockfd;
     sockaddr_in m_address;
     //定时器节点
     ListNode *m_node;
+    //事件循环推迟到下一轮处理的事件，0表示不在推迟队列中
+    uint32_t m_deferred;
 
 private:
     /*读缓冲区*/
@@ -169,6 +190,15 @@ private:
     /*我们将采用writev来执行写操作，所以定义下面两个成员，其中m_iv_count表示被写内存块的数量*/
     struct iovec m_iv[2];
     int m_iv_count;
+    /*还要发送的字节数和已经发送的字节数，writev可能需要多次才能发送完*/
+    int bytes_to_send;
+    int bytes_have_send;
+    /*第二个IO向量的内容：mmap的文件或者m_body*/
+    char *m_body_address;
+    /*动态生成的响应体，例如/metrics*/
+    std::string m_body;
+    /*当前请求开始读取的时间(微秒)*/
+    uint64_t m_request_start;
 };
 
 #endif
\ No newline at end of file
@@ -12,6 +12,7 @@
 #include <stdlib.h>
 
 #include "http.h"
+#include "arena.h"
 #define BUFFERSIZE 2048
 #define TIMESLOT 1
 
@@ -32,6 +33,7 @@ public:
 };
 
 //初始化链表、销毁链表、添加定时事件、调整定时事件、删除定时事件、执行定时任务
+//定时器节点从链表自己的对象池中分配，pop/tick删除节点时放回对象池
 class ListClock
 {
 public:
@@ -42,10 +44,15 @@ public:
         while (tmp)
         {
             head = tmp->next;
-            delete tmp;
+            m_pool.destroy(tmp);
             tmp = head;
         }
     }
+    //分配一个定时器节点，由push加入链表
+    ListNode *create()
+    {
+        return m_pool.create();
+    }
     void push(ListNode *node)
     {
         if (!node)
@@ -54,7 +61,7 @@ public:
         }
         if (!head)
         {
-            head = node;
+            head = tail = node;
             return;
         }
         //头插法：小的事件插入到前面
@@ -107,7 +114,7 @@ public:
         //链表中只有一个定时器(链表长度为1)
         if ((node == head) && (node == tail))
         {
-            delete node;
+            m_pool.destroy(node);
             head = nullptr;
             tail = nullptr;
             return;
@@ -118,7 +125,7 @@ public:
         {
             head = head->next;
             head->prev = nullptr;
-            delete node;
+            m_pool.destroy(node);
             return;
         }
 
@@ -127,14 +134,14 @@ public:
         {
             tail = tail->prev;
             tail->next = nullptr;
-            delete node;
+            m_pool.destroy(node);
             return;
         }
 
         //node不是head、tail
         node->next->prev = node->prev;
         node->prev->next = node->next;
-        delete node;
+        m_pool.destroy(node);
     }
 
     //执行定时任务：每隔一段时间调用一次来处理定时事件
@@ -142,17 +149,14 @@ public:
     {
         if (!head)
         {
-            printf("timer is null\n");
             return;
         }
-        printf("timer tick\n");
         time_t cur = time(nullptr); //当前时间
         auto tmp = head;
         while (tmp)
         {
             if (cur < tmp->expire) //还没有达到处理时间，break，等待下一次调用tick()
             {
-                printf("unarrive expire time");
                 break;
             }
 
@@ -165,7 +169,7 @@ public:
             {
                 head->prev = nullptr;
             }
-            delete tmp;
+            m_pool.destroy(tmp);
             tmp = head;
         }
     }
@@ -202,6 +206,7 @@ private:
 public:
     ListNode *head;
     ListNode *tail;
+    ObjectPool<ListNode> m_pool; //定时器节点的对象池
 };
 
 #endif // LISTCLOCK_H
\ No newline at end of file
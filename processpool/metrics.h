@@ -0,0 +1,306 @@
+/**
+ * @author: fenghaze
+ * @date: 2026/10/19 17:10
+ * @desc: 进程池的运行指标
+ * master创建一块POSIX共享内存（shm_open），每个worker只写自己的那一项，不加锁
+ * 读取方（/metrics、httpserver_processpool --metrics）把所有worker的计数累加后输出
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <string>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+//响应状态码的统计项
+enum METRICS_STATUS
+{
+    STATUS_200 = 0,
+    STATUS_400,
+    STATUS_403,
+    STATUS_404,
+    STATUS_500,
+    STATUS_OTHER,
+    STATUS_NUM
+};
+
+//请求耗时直方图的上界(微秒)，最后一项为+Inf
+static const uint64_t LATENCY_BOUNDS[] = {100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000};
+static const int LATENCY_BUCKETS = sizeof(LATENCY_BOUNDS) / sizeof(LATENCY_BOUNDS[0]) + 1;
+
+//每个计数只有一个进程写，用relaxed的load+store代替带lock前缀的fetch_add
+inline void metrics_add(std::atomic<uint64_t> &counter, uint64_t n = 1)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+//单调时钟(微秒)
+inline uint64_t metrics_now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+//一个worker的计数，独占cache line，worker之间不会伪共享
+struct alignas(64) WorkerMetrics
+{
+    std::atomic<uint64_t> accepts;       //接受的连接
+    std::atomic<uint64_t> requests;      //生成的响应
+    std::atomic<uint64_t> bytes_out;     //发送的字节
+    std::atomic<uint64_t> status[STATUS_NUM];
+    std::atomic<uint64_t> timer_expired; //定时器关闭的非活动连接
+    std::atomic<uint64_t> parse_errors;  //解析失败的请求
+    std::atomic<uint64_t> write_errors;  //发送失败的响应
+    std::atomic<uint64_t> rejected;      //超过worker_connections被拒绝的连接
+    std::atomic<uint64_t> migrations;    //事件循环两次醒来时所在的CPU不同
+    std::atomic<uint64_t> last_cpu;      //最近一次醒来时所在的CPU
+    std::atomic<uint64_t> latency[LATENCY_BUCKETS];
+    std::atomic<uint64_t> latency_sum_us;
+
+    void status_code(int code)
+    {
+        int idx = code == 200 ? STATUS_200 : code == 400 ? STATUS_400 : code == 403 ? STATUS_403 : code == 404 ? STATUS_404 : code == 500 ? STATUS_500 : STATUS_OTHER;
+        metrics_add(requests);
+        metrics_add(status[idx]);
+    }
+
+    void observe(uint64_t us)
+    {
+        int idx = 0;
+        while (idx < LATENCY_BUCKETS - 1 && us > LATENCY_BOUNDS[idx])
+        {
+            ++idx;
+        }
+        metrics_add(latency[idx]);
+        metrics_add(latency_sum_us, us);
+    }
+};
+
+//master的计数
+struct alignas(64) MasterMetrics
+{
+    std::atomic<uint64_t> accepts;    //PASS_FD模式下master接受的连接
+    std::atomic<uint64_t> batches;    //发送给worker的消息
+    std::atomic<uint64_t> respawns;   //异常退出后重新创建的worker
+    std::atomic<uint64_t> scale_ups;
+    std::atomic<uint64_t> scale_downs;
+    std::atomic<uint64_t> local_dispatch; //按SO_INCOMING_CPU交给绑定在同一个CPU上的worker
+    std::atomic<uint64_t> redispatched;   //worker的管道满了，改发给另一个worker的连接
+    std::atomic<uint64_t> shed;           //没有worker能接收，返回503后关闭的连接
+    std::atomic<uint64_t> emfile;         //fd用完时用预留的fd接受并关闭的连接
+    std::atomic<uint64_t> accept_errors;  //其他accept失败
+};
+
+//共享内存的布局：头部 + worker_num个WorkerMetrics
+struct alignas(64) MetricsPage
+{
+    static const uint32_t MAGIC = 0x4d545243; //"MTRC"
+    uint32_t magic;
+    int worker_num;
+    pid_t master_pid;
+    MasterMetrics master;
+    std::atomic<int> worker_pid[64]; //每个槽位当前的worker进程，-1表示空闲
+    std::atomic<int> worker_cpu[64]; //每个槽位绑定的CPU，-1表示没有绑定
+
+    WorkerMetrics *workers() { return reinterpret_cast<WorkerMetrics *>(this + 1); }
+    const WorkerMetrics *workers() const { return reinterpret_cast<const WorkerMetrics *>(this + 1); }
+
+    static size_t size(int worker_num) { return sizeof(MetricsPage) + sizeof(WorkerMetrics) * worker_num; }
+};
+
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "MetricsPage must be usable across processes");
+
+//共享内存的名字，按端口区分同一台机器上的多个实例
+inline void metrics_shm_name(int port, char *name, size_t len)
+{
+    snprintf(name, len, "/httpserver_processpool.%d", port);
+}
+
+//master创建共享内存：热升级时新的master使用新的一块，旧进程继续使用自己映射的那一块
+//shm_open失败时（例如没有/dev/shm）退化为匿名映射，/metrics依然可用，只是命令行工具读不到
+inline MetricsPage *metrics_create(const char *name, int worker_num)
+{
+    if (worker_num > 64)
+    {
+        return nullptr;
+    }
+    size_t size = MetricsPage::size(worker_num);
+    void *addr = MAP_FAILED;
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0644);
+    if (fd >= 0)
+    {
+        if (ftruncate(fd, size) == 0)
+        {
+            addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (addr == MAP_FAILED)
+        {
+            shm_unlink(name);
+        }
+    }
+    if (addr == MAP_FAILED)
+    {
+        perror("shm_open()");
+        addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED)
+        {
+            return nullptr;
+        }
+    }
+    //新映射的内存全为0，只需要设置非0的字段
+    MetricsPage *page = static_cast<MetricsPage *>(addr);
+    page->magic = MetricsPage::MAGIC;
+    page->worker_num = worker_num;
+    page->master_pid = getpid();
+    for (int i = 0; i < 64; i++)
+    {
+        page->worker_pid[i] = -1;
+        page->worker_cpu[i] = -1;
+    }
+    return page;
+}
+
+//只读方式映射已经存在的共享内存，给命令行工具使用
+inline const MetricsPage *metrics_attach(const char *name)
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(MetricsPage))
+    {
+        close(fd);
+        return nullptr;
+    }
+    void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+    {
+        return nullptr;
+    }
+    const MetricsPage *page = static_cast<const MetricsPage *>(addr);
+    if (page->magic != MetricsPage::MAGIC || MetricsPage::size(page->worker_num) > (size_t)st.st_size)
+    {
+        munmap(addr, st.st_size);
+        return nullptr;
+    }
+    return page;
+}
+
+//master退出时删除共享内存的名字；热升级后名字已经属于新的master，不能删除
+inline void metrics_destroy(const char *name, const MetricsPage *page)
+{
+    const MetricsPage *cur = metrics_attach(name);
+    if (cur)
+    {
+        if (cur->master_pid == page->master_pid)
+        {
+            shm_unlink(name);
+        }
+        munmap((void *)cur, MetricsPage::size(cur->worker_num));
+    }
+}
+
+//输出Prometheus文本格式：所有worker累加的总数，以及每个worker的连接数和请求数
+inline std::string metrics_render(const MetricsPage *page)
+{
+    static const char *status_label[STATUS_NUM] = {"200", "400", "403", "404", "500", "other"};
+    const WorkerMetrics *w = page->workers();
+    uint64_t accepts = 0, requests = 0, bytes = 0, expired = 0, parse = 0, write = 0, rejected = 0, sum = 0;
+    uint64_t status[STATUS_NUM] = {0}, latency[LATENCY_BUCKETS] = {0};
+    for (int i = 0; i < page->worker_num; i++)
+    {
+        accepts += w[i].accepts;
+        requests += w[i].requests;
+        bytes += w[i].bytes_out;
+        expired += w[i].timer_expired;
+        parse += w[i].parse_errors;
+        write += w[i].write_errors;
+        rejected += w[i].rejected;
+        sum += w[i].latency_sum_us;
+        for (int k = 0; k < STATUS_NUM; k++)
+        {
+            status[k] += w[i].status[k];
+        }
+        for (int k = 0; k < LATENCY_BUCKETS; k++)
+        {
+            latency[k] += w[i].latency[k];
+        }
+    }
+
+    std::string out;
+    char line[256];
+    auto emit = [&](const char *name, uint64_t value) {
+        snprintf(line, sizeof(line), "%s %llu\n", name, (unsigned long long)value);
+        out += line;
+    };
+    emit("httpserver_master_accepts_total", page->master.accepts);
+    emit("httpserver_master_batches_total", page->master.batches);
+    emit("httpserver_worker_respawns_total", page->master.respawns);
+    emit("httpserver_scale_ups_total", page->master.scale_ups);
+    emit("httpserver_scale_downs_total", page->master.scale_downs);
+    emit("httpserver_local_dispatch_total", page->master.local_dispatch);
+    emit("httpserver_master_redispatched_total", page->master.redispatched);
+    emit("httpserver_master_shed_total", page->master.shed);
+    emit("httpserver_master_emfile_total", page->master.emfile);
+    emit("httpserver_master_accept_errors_total", page->master.accept_errors);
+    emit("httpserver_accepts_total", accepts);
+    emit("httpserver_requests_total", requests);
+    emit("httpserver_bytes_out_total", bytes);
+    emit("httpserver_timer_expired_total", expired);
+    emit("httpserver_parse_errors_total", parse);
+    emit("httpserver_write_errors_total", write);
+    emit("httpserver_rejected_total", rejected);
+    for (int k = 0; k < STATUS_NUM; k++)
+    {
+        snprintf(line, sizeof(line), "httpserver_responses_total{status=\"%s\"} %llu\n", status_label[k], (unsigned long long)status[k]);
+        out += line;
+    }
+    //直方图的bucket是累计值
+    uint64_t cumulative = 0;
+    for (int k = 0; k < LATENCY_BUCKETS; k++)
+    {
+        cumulative += latency[k];
+        if (k < LATENCY_BUCKETS - 1)
+        {
+            snprintf(line, sizeof(line), "httpserver_request_duration_us_bucket{le=\"%llu\"} %llu\n", (unsigned long long)LATENCY_BOUNDS[k], (unsigned long long)cumulative);
+        }
+        else
+        {
+            snprintf(line, sizeof(line), "httpserver_request_duration_us_bucket{le=\"+Inf\"} %llu\n", (unsigned long long)cumulative);
+        }
+        out += line;
+    }
+    emit("httpserver_request_duration_us_sum", sum);
+    emit("httpserver_request_duration_us_count", cumulative);
+    for (int i = 0; i < page->worker_num; i++)
+    {
+        if (page->worker_pid[i] == -1)
+        {
+            continue;
+        }
+        snprintf(line, sizeof(line), "httpserver_worker_requests_total{worker=\"%d\",pid=\"%d\"} %llu\n", i, page->worker_pid[i].load(), (unsigned long long)w[i].requests);
+        out += line;
+        snprintf(line, sizeof(line), "httpserver_worker_cpu{worker=\"%d\",pinned=\"%d\"} %llu\n", i, page->worker_cpu[i].load(), (unsigned long long)w[i].last_cpu);
+        out += line;
+        snprintf(line, sizeof(line), "httpserver_worker_migrations_total{worker=\"%d\"} %llu\n", i, (unsigned long long)w[i].migrations);
+        out += line;
+    }
+    return out;
+}
+
+#endif // METRICS_H
@@ -2,7 +2,8 @@
  * @author: fenghaze
  * @date: 2021/06/04 17:46
  * @desc:
- * master进程创建一个epoll监听lfd，通过管道分发（round robin算法）任务给子进程，让子进程accept连接
+ * master进程创建一个epoll监听lfd，按共享内存中的负载（power of two choices）选择worker：
+ * PASS_FD模式下master批量accept4，通过SCM_RIGHTS把cfd交给worker；ACCEPT_TOKEN模式下通过管道通知worker自己accept
  * 每个个worker进程创建一个epoll监听管道接受accept，之后监听这个客户的cfd
  */
 
@@ -10,6 +11,7 @@
 #define PROCESSPOOL_H
 
 #include <vector>
+#include <deque>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -21,28 +23,42 @@
 #include <string.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <sys/epoll.h>
 #include <signal.h>
 #include <sys/wait.h>
+#include <poll.h>
 #include <sys/stat.h>
+#include <limits.h>
 #include <string>
 #include "listClock.h"
 #include "utils.h"
 #include "http.h"
+#include "workerload.h"
+#include "metrics.h"
+#include "affinity.h"
+#include "../utils/Listener.h"
 static int sig_pipefd[2];
+//当前worker进程在共享内存中的负载，master进程中为nullptr
+static WorkerLoad *worker_load = nullptr;
 
 //定时器的回调：关闭非活动连接
 void clock_func(int epfd, HTTPConn *user)
 {
-    //移除节点
-    epoll_ctl(epfd, EPOLL_CTL_DEL, user->m_sockfd, 0);
     assert(user);
-    close(user->m_sockfd);
-    printf("close cfd %d\n", user->m_sockfd);
+    metrics_add(HTTPConn::m_metrics->timer_expired);
+    if (user->responding())
+    {
+        worker_load->inflight--;
+    }
+    worker_load->clients--;
+    //移除节点，定时器节点由tick()释放
+    user->close_conn(true);
+    user->m_node = nullptr;
 }
 
 //触发定时器
-void time_handler(ListClock list_clock, int epfd)
+void time_handler(ListClock &list_clock, int epfd)
 {
     //调用tick，处理定时器任务
     list_clock.tick(epfd);
@@ -72,16 +88,64 @@ static void addsig(int sig, void(handler)(int), bool restart = true)
     sigfillset(&sa.sa_mask);
     assert(sigaction(sig, &sa, NULL) != -1);
 }
+//master和worker之间通过socketpair传递的消息，每条消息的第一个int是命令
+enum DISPATCH_CMD
+{
+    CMD_STOP = -1,  //worker退出
+    CMD_ACCEPT = 1, //worker自己accept一个连接
+    CMD_CONN = 2    //master已经accept，连接通过SCM_RIGHTS传递
+};
+
+//分发连接的方式
+enum DISPATCH_MODE
+{
+    ACCEPT_TOKEN, //master发送CMD_ACCEPT，worker自己accept
+    PASS_FD       //master批量accept4，通过SCM_RIGHTS把cfd交给worker
+};
+
+//PASS_FD模式下一条消息携带的连接，fd在辅助数据中，顺序和addrs一致
+struct ConnBatch
+{
+    static const int MAX_FDS = 16;
+    int cmd; //CMD_CONN
+    int count;
+    struct sockaddr_in addrs[MAX_FDS];
+};
+
+//事件循环每一轮的处理上限，超出的部分留到下一轮，避免少数繁忙的连接饿死accept和信号处理
+struct ReactorBudget
+{
+    int events;  //每次epoll_wait最多取出的事件数
+    int accepts; //每轮最多接受的连接
+    int reads;   //每轮最多处理的可读连接
+    int writes;  //每轮最多处理的可写连接
+    int connections; //每个worker同时服务的连接数上限，也是连接数组的大小
+
+    ReactorBudget() : events(1024), accepts(256), reads(256), writes(256), connections(65535) {}
+};
+
+//SIGHUP时master和每个worker各自调用一次：重新加载配置，修改budget中每轮的预算，失败时返回false
+//events和connections已经用来分配数组，修改不会生效
+typedef bool (*ReloadFunc)(ReactorBudget &budget);
+
 //子进程类
 class WorkerProcess
 {
 public:
-    pid_t m_pid;     //子进程PID
-    int m_pipefd[2]; //用于和父进程通信的管道
-    int m_clients;   //记录当前连接的客户数量
+    pid_t m_pid;      //子进程PID
+    int m_pipefd[2];  //用于和父进程通信的管道
+    int m_dispatched; //master发给该进程的accept通知数
+    bool m_retiring;  //master主动回收该进程，退出后不用重新创建
+    int m_cpu;         //绑定的CPU，-1表示没有绑定
+    ConnBatch m_batch; //PASS_FD模式下等待发送的连接
+    int m_batch_fds[ConnBatch::MAX_FDS];
 
 public:
-    WorkerProcess() : m_pid(-1), m_clients(0) {}
+    WorkerProcess() : m_pid(-1), m_dispatched(0), m_retiring(false), m_cpu(-1)
+    {
+        m_batch.cmd = CMD_CONN;
+        m_batch.count = 0;
+    }
 };
 
 //进程池
@@ -90,75 +154,719 @@ class ProcessPool
 {
 public:
     //懒汉模式
-    static ProcessPool<T> &create(int lfd, int min_process_num, int max_process_num)
+    //ready_fd：热升级时旧的master等待的管道，第一个worker就绪后写入一个字节，-1表示不是热升级启动的
+    static ProcessPool<T> &create(int lfd, int min_process_num, int max_process_num, DISPATCH_MODE mode = PASS_FD, const ReactorBudget &budget = ReactorBudget(), int ready_fd = -1)
     {
-        static ProcessPool<T> mInstance(lfd, min_process_num, max_process_num);
+        static ProcessPool<T> mInstance(lfd, min_process_num, max_process_num, mode, budget, ready_fd);
         return mInstance;
     }
     void run();
 
+    //设置SIGHUP的处理函数，必须在run()之前调用
+    void set_reload(ReloadFunc func) { m_reload = func; }
+
+    //记下可执行文件和命令行参数，SIGUSR2热升级时按原样启动，必须在run()之前调用
+    void set_exec(int argc, const char *const argv[]);
+
 private:
-    ProcessPool(int lfd, int min_process_num, int max_process_num);
+    ProcessPool(int lfd, int min_process_num, int max_process_num, DISPATCH_MODE mode, const ReactorBudget &budget, int ready_fd);
     ~ProcessPool();
     void init_sig_pipe();
     void run_master();
     void run_worker();
-    int select_worker();
+    //选择接收新连接的worker，跳过exclude，没有可用的worker时返回-1
+    int select_worker(int exclude = -1);
+    //worker的负载分数，越小越空闲
+    int worker_score(int idx);
+    //绑定在cpu上负载最小的worker，没有时返回-1
+    int worker_on_cpu(int cpu);
+    //创建第idx个worker进程，在子进程中返回true
+    bool spawn(int idx);
+    //根据worker上报的负载扩容、缩容，每TIMESLOT秒执行一次
+    void adjust_workers();
+    //关闭客户连接，移除定时事件
+    void close_client(FdArena<T> &users, int sockfd, ListClock &list_clock);
+    //worker开始服务一个新连接，设置定时事件
+    void add_client(FdArena<T> &users, int cfd, const sockaddr_in &addr, ListClock &list_clock);
+    //master通知worker的命令
+    void send_cmd(int idx, int cmd);
+    //PASS_FD模式：master接受所有等待的连接，按worker分批发送
+    void accept_conns();
+    //把worker积攒的连接发给它；它的管道满了时改发给另一个worker，都不行时返回503
+    void flush_batch(int idx);
+    //fd用完时释放预留的fd，接受一个连接返回503后关闭，再重新预留；返回是否接受了连接
+    bool drop_one();
+    //master直接返回503并关闭连接
+    void shed_conn(int cfd);
+    //热升级启动的master：有worker就绪后通知旧的master开始排空
+    void notify_ready();
+    //master停止接受连接，通知所有worker排空
+    void shutdown();
+    //master启动新的可执行文件，新进程继承m_lfd；新的master就绪后返回true，失败时旧的master继续服务
+    bool upgrade();
+    //worker停止接受连接，关闭空闲连接，剩下的连接发送完当前响应后关闭
+    void start_drain(FdArena<T> &users, ListClock &list_clock);
+    //PASS_FD模式：worker收到的一条连接消息，返回接受的连接数
+    int recv_conns(FdArena<T> &users, const ConnBatch &batch, struct msghdr &msg, ListClock &list_clock);
+    //worker读取master的消息，accept预算用完时返回false，管道中剩下的消息下一轮再读
+    bool recv_cmds(FdArena<T> &users, ListClock &list_clock);
+    //worker处理一个客户连接上的事件
+    void handle_client(FdArena<T> &users, int sockfd, uint32_t events, ListClock &list_clock);
+    //调用m_reload更新每轮的预算，master成功后转发SIGHUP给所有worker
+    void reload();
 
 private:
     /*所有进程共享的变量*/
-    static const int PER_PROCESS_USER = 65535; //每个woker进程能够连接的最大客户数
-    static const int MAX_EVENT_NUMBER = 10000; //每个epoll能够监听的最大事件数
-    WorkerProcess *m_workers;                  //worker进程池
+    static const int SCALE_UP_BUSY = 750;      //平均繁忙比例超过75%时扩容
+    static const int SCALE_UP_CLIENTS = 1000;  //平均连接数超过1000时扩容
+    static const int SCALE_UP_BACKLOG = 64;    //积压的accept通知和未发送完的响应超过64时扩容
+    static const int SCALE_DOWN_BUSY = 200;    //平均繁忙比例低于20%时才考虑缩容
+    static const int SCALE_DOWN_TICKS = 10;    //连续空闲10个周期才缩容
+    static const int DRAIN_TIMEOUT = 10;       //排空的最长时间(秒)，超时后worker直接退出
+    static const int ACCEPT_RETRY_MS = 10;     //没有可用worker时，master重试accept的间隔
+    static const int LOCAL_SLACK = 8;          //同CPU的worker负载分数最多比随机选择的高这么多
+    static const int UPGRADE_TIMEOUT = 5;      //热升级时等待新的master就绪的最长时间(秒)
+    static const char BUSY_RESPONSE[];         //master没有worker可以接收连接时的503
+    WorkerProcess *m_workers;                  //worker进程池，大小为m_max_process
+    WorkerLoad *m_load;                        //所有worker的负载，master和worker共享
+    int *m_candidates;                         //select_worker使用的临时数组
+    MetricsPage *m_metrics;                    //运行指标，master和worker共享，其他进程可以通过shm_open读取
+    char m_metrics_name[64];                   //指标共享内存的名字
     int m_min_process;                         //最小进程数
     int m_max_process;                         //最大进程数
     int m_lfd;                                 //服务类提供的listenfd
+    DISPATCH_MODE m_mode;                      //分发连接的方式
+    ReactorBudget m_budget;                    //事件循环每一轮的处理上限
+    ReloadFunc m_reload;                       //SIGHUP时重新加载配置，为空时忽略SIGHUP
+    std::string m_exec_path;                   //热升级时启动的可执行文件
+    std::vector<std::string> m_exec_argv;      //热升级时的命令行参数
 
     /*master进程和worker进程不同的变量*/
-    int m_stop; //每个进程结束的标志
-    int m_idx;  //每个worker进程的索引号，master进程的索引号为-1
-    int m_epfd; //每个worker进程的epfd句柄
+    int m_stop;        //每个进程结束的标志
+    int m_idx;         //每个worker进程的索引号，master进程的索引号为-1
+    int m_epfd;        //每个worker进程的epfd句柄
+    bool m_terminated; //master收到SIGTERM/SIGINT，不再创建worker进程
+    int m_idle_ticks;  //master连续空闲的周期数
+    bool m_accept_pending;    //master还有没accept的连接
+    bool m_accept_more;       //master的accept预算用完，监听队列中可能还有连接
+    bool m_draining;          //worker正在排空
+    time_t m_drain_deadline;  //排空的截止时间
+    int m_spare_fd;           //master预留的fd，accept遇到EMFILE时使用
+    int m_ready_fd;           //热升级时通知旧的master的管道，通知之后为-1
 };
 
 template <typename T>
-ProcessPool<T>::ProcessPool(int lfd, int min_process_num, int max_process_num) : m_lfd(lfd), m_min_process(min_process_num), m_max_process(max_process_num), m_idx(-1), m_stop(false), m_epfd(-1)
+ProcessPool<T>::ProcessPool(int lfd, int min_process_num, int max_process_num, DISPATCH_MODE mode, const ReactorBudget &budget, int ready_fd) : m_min_process(min_process_num), m_max_process(max_process_num), m_lfd(lfd), m_mode(mode), m_budget(budget), m_reload(nullptr), m_stop(false), m_idx(-1), m_epfd(-1), m_terminated(false), m_idle_ticks(0), m_accept_pending(false), m_accept_more(false), m_draining(false), m_drain_deadline(0), m_spare_fd(-1), m_ready_fd(ready_fd)
 {
     assert((min_process_num > 0) && (min_process_num <= max_process_num));
-    //创建空间
-    m_workers = new WorkerProcess[m_min_process];
+    assert(m_budget.events > 0 && m_budget.accepts > 0 && m_budget.reads > 0 && m_budget.writes > 0 && m_budget.connections > 0);
+    //按最大进程数创建空间，扩容时使用空闲的位置
+    m_workers = new WorkerProcess[m_max_process];
+    m_load = create_worker_load(m_max_process);
+    assert(m_load);
+    m_candidates = new int[m_max_process];
+    //指标共享内存按监听端口命名
+    struct sockaddr_in laddr;
+    socklen_t laddr_len = sizeof(laddr);
+    getsockname(m_lfd, (struct sockaddr *)&laddr, &laddr_len);
+    metrics_shm_name(ntohs(laddr.sin_port), m_metrics_name, sizeof(m_metrics_name));
+    m_metrics = metrics_create(m_metrics_name, m_max_process);
+    assert(m_metrics);
     //初始化
     for (int i = 0; i < min_process_num; i++)
     {
-        socketpair(PF_UNIX, SOCK_STREAM, 0, m_workers[i].m_pipefd);
-        m_workers[i].m_pid = fork();
-        assert(m_workers[i].m_pid >= 0);
-        //worker进程关闭socketpair写端，改变m_idx
-        if (m_workers[i].m_pid == 0)
+        //worker进程退出循环，回到run()
+        if (spawn(i))
         {
-            close(m_workers[i].m_pipefd[0]);
-            m_idx = i;
             break;
         }
-        //master进程关闭socketpair读端
-        else
+    }
+}
+
+template <typename T>
+ProcessPool<T>::~ProcessPool()
+{
+    delete[] m_workers;
+    delete[] m_candidates;
+}
+
+template <typename T>
+bool ProcessPool<T>::spawn(int idx)
+{
+    m_load[idx].reset();
+    m_workers[idx].m_dispatched = 0;
+    m_workers[idx].m_retiring = false;
+    m_workers[idx].m_cpu = CpuPlacement::instance().cpu_for(idx);
+    //SOCK_SEQPACKET保留消息边界，一条消息对应一次sendmsg，连接消息和辅助数据不会被拆开或合并
+    socketpair(PF_UNIX, SOCK_SEQPACKET, 0, m_workers[idx].m_pipefd);
+    //避免子进程继承缓冲区中还没有输出的日志
+    fflush(stdout);
+    m_workers[idx].m_pid = fork();
+    assert(m_workers[idx].m_pid >= 0);
+    //worker进程关闭socketpair写端和master的其他管道，改变m_idx
+    if (m_workers[idx].m_pid == 0)
+    {
+        close(m_workers[idx].m_pipefd[0]);
+        for (int k = 0; k < m_max_process; k++)
+        {
+            if (k != idx && m_workers[k].m_pid != -1)
+            {
+                close(m_workers[k].m_pipefd[0]);
+            }
+        }
+        //运行过程中创建的worker进程不使用master的epfd和信号管道
+        if (m_epfd != -1)
+        {
+            close(m_epfd);
+            close(sig_pipefd[0]);
+            close(sig_pipefd[1]);
+            m_epfd = -1;
+        }
+        if (m_spare_fd >= 0)
+        {
+            close(m_spare_fd);
+            m_spare_fd = -1;
+        }
+        //worker不能替master通知旧的master
+        if (m_ready_fd >= 0)
+        {
+            close(m_ready_fd);
+            m_ready_fd = -1;
+        }
+        m_idx = idx;
+        //绑定CPU，避免worker在处理请求的过程中被迁移到其他核
+        if (m_workers[idx].m_cpu != -1)
+        {
+            CpuPlacement::pin(m_workers[idx].m_cpu);
+        }
+        return true;
+    }
+    //master进程关闭socketpair读端
+    close(m_workers[idx].m_pipefd[1]);
+    m_metrics->worker_pid[idx] = m_workers[idx].m_pid;
+    m_metrics->worker_cpu[idx] = m_workers[idx].m_cpu;
+    return false;
+}
+
+template <typename T>
+int ProcessPool<T>::worker_score(int idx)
+{
+    //连接数 + 未发送完的响应 + 还没有处理的通知 + 还没有发送的连接
+    return m_load[idx].clients + m_load[idx].inflight + (m_workers[idx].m_dispatched - m_load[idx].tokens) + m_workers[idx].m_batch.count;
+}
+
+template <typename T>
+int ProcessPool<T>::worker_on_cpu(int cpu)
+{
+    int best = -1;
+    for (int k = 0; k < m_max_process; k++)
+    {
+        if (m_workers[k].m_cpu == cpu && m_workers[k].m_pid != -1 && !m_workers[k].m_retiring && m_load[k].ready &&
+            (best == -1 || worker_score(k) < worker_score(best)))
         {
-            close(m_workers[i].m_pipefd[1]);
+            best = k;
+        }
+    }
+    return best;
+}
+
+template <typename T>
+int ProcessPool<T>::select_worker(int exclude)
+{
+    //收集已经完成初始化的worker
+    int n = 0;
+    for (int k = 0; k < m_max_process; k++)
+    {
+        if (k != exclude && m_workers[k].m_pid != -1 && !m_workers[k].m_retiring && m_load[k].ready)
+        {
+            m_candidates[n++] = k;
+        }
+    }
+    if (n == 0)
+    {
+        return -1;
+    }
+    if (n == 1)
+    {
+        return m_candidates[0];
+    }
+    //power of two choices：随机选两个，取负载较小的一个
+    //比直接选最小值更不容易让所有新连接同时涌向同一个刚空闲下来的worker
+    int i = rand() % n;
+    int j = rand() % (n - 1);
+    if (j >= i)
+    {
+        j++;
+    }
+    int a = m_candidates[i], b = m_candidates[j];
+    return worker_score(a) <= worker_score(b) ? a : b;
+}
+
+template <typename T>
+void ProcessPool<T>::adjust_workers()
+{
+    int live = 0, busy = 0, clients = 0, backlog = 0, inflight = 0;
+    int idle_worker = -1, free_slot = -1;
+    for (int k = 0; k < m_max_process; k++)
+    {
+        if (m_workers[k].m_pid == -1)
+        {
+            if (free_slot == -1)
+            {
+                free_slot = k;
+            }
             continue;
         }
+        if (m_workers[k].m_retiring)
+        {
+            continue;
+        }
+        live++;
+        busy += m_load[k].busy_permille;
+        clients += m_load[k].clients;
+        backlog += m_workers[k].m_dispatched - m_load[k].tokens;
+        inflight += m_load[k].inflight;
+        if (m_load[k].clients == 0)
+        {
+            idle_worker = k;
+        }
+    }
+    if (live == 0)
+    {
+        return;
+    }
+    //扩容：新进程初始化完成(ready)之后才会被select_worker选中
+    if (live < m_max_process && free_slot != -1 &&
+        (busy / live > SCALE_UP_BUSY || clients / live > SCALE_UP_CLIENTS || backlog + inflight > SCALE_UP_BACKLOG))
+    {
+        m_idle_ticks = 0;
+        printf("scale up: busy %d‰ clients %d backlog %d inflight %d, create worker[%d]\n", busy / live, clients, backlog, inflight, free_slot);
+        metrics_add(m_metrics->master.scale_ups);
+        if (spawn(free_slot))
+        {
+            run_worker();
+            exit(0);
+        }
+        return;
+    }
+    //缩容：连续空闲一段时间后，回收一个没有客户连接的worker
+    if (live > m_min_process && busy / live < SCALE_DOWN_BUSY && clients * 4 < SCALE_UP_CLIENTS * live)
+    {
+        if (++m_idle_ticks >= SCALE_DOWN_TICKS && idle_worker != -1)
+        {
+            m_idle_ticks = 0;
+            printf("scale down: retire worker[%d]\n", idle_worker);
+            m_workers[idle_worker].m_retiring = true;
+            metrics_add(m_metrics->master.scale_downs);
+            send_cmd(idle_worker, CMD_STOP);
+        }
+        return;
     }
+    m_idle_ticks = 0;
 }
 
 template <typename T>
-ProcessPool<T>::~ProcessPool()
+void ProcessPool<T>::close_client(FdArena<T> &users, int sockfd, ListClock &list_clock)
 {
-    delete[] m_workers;
+    //同一个连接可能在多个地方被关闭（例如process()内部已经关闭了socket），定时事件只移除一次
+    if (!users[sockfd].m_node)
+    {
+        return;
+    }
+    if (users[sockfd].responding())
+    {
+        m_load[m_idx].inflight--;
+    }
+    users[sockfd].close_conn(true);
+    //移除定时事件
+    list_clock.pop(users[sockfd].m_node);
+    users[sockfd].m_node = nullptr;
+    m_load[m_idx].clients--;
 }
 
 template <typename T>
-int ProcessPool<T>::select_worker()
+void ProcessPool<T>::add_client(FdArena<T> &users, int cfd, const sockaddr_in &addr, ListClock &list_clock)
 {
-    int worker_id = rand() % m_min_process;
-    return worker_id;
+    //连接对象按fd下标存放，超出数组的fd只能拒绝
+    if (cfd >= users.capacity())
+    {
+        metrics_add(T::m_metrics->rejected);
+        close(cfd);
+        return;
+    }
+    Listener::instance().tune(cfd);
+    m_load[m_idx].clients++;
+    metrics_add(T::m_metrics->accepts);
+    //为该客户初始化服务，init中会监听cfd；第一次使用这个fd时才构造连接对象
+    users.get(cfd).init(m_epfd, cfd, addr);
+    //同一个fd之前的连接可能还留在推迟队列中
+    users[cfd].m_deferred = 0;
+
+    //设置定时事件
+    ListNode *node = list_clock.create();
+    node->callback = clock_func;
+    node->client_data = &users[cfd];
+    time_t cur = time(nullptr);
+    node->expire = cur + T::m_idle_timeout; //m_idle_timeout秒内没有新的请求则关闭
+
+    users[cfd].m_node = node;
+
+    list_clock.push(node);
+}
+
+template <typename T>
+int ProcessPool<T>::recv_conns(FdArena<T> &users, const ConnBatch &batch, struct msghdr &msg, ListClock &list_clock)
+{
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+    {
+        return 0;
+    }
+    int n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    int fds[ConnBatch::MAX_FDS];
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * n);
+    m_load[m_idx].tokens += n;
+    for (int k = 0; k < n; k++)
+    {
+        if (m_load[m_idx].clients >= m_budget.connections || k >= batch.count)
+        {
+            metrics_add(T::m_metrics->rejected);
+            close(fds[k]);
+            continue;
+        }
+        add_client(users, fds[k], batch.addrs[k], list_clock);
+    }
+    return n;
+}
+
+template <typename T>
+bool ProcessPool<T>::recv_cmds(FdArena<T> &users, ListClock &list_clock)
+{
+    int sockfd = m_workers[m_idx].m_pipefd[1];
+    WorkerLoad &load = m_load[m_idx];
+    ConnBatch batch;
+    char control[CMSG_SPACE(sizeof(int) * ConnBatch::MAX_FDS)];
+    struct iovec iov = {&batch, sizeof(batch)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    //管道是ET模式，预算之内一次读完所有消息；一条消息中的连接不会拆开处理
+    int accepted = 0;
+    while (accepted < m_budget.accepts)
+    {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        int ret = recvmsg(sockfd, &msg, MSG_CMSG_CLOEXEC);
+        //master已经退出（例如热升级超时被旧的master杀掉），不会再有新连接，排空后退出
+        if (ret == 0)
+        {
+            start_drain(users, list_clock);
+            return true;
+        }
+        if (ret < (int)sizeof(int))
+        {
+            return true;
+        }
+        //master通知退出
+        if (batch.cmd == CMD_STOP)
+        {
+            start_drain(users, list_clock);
+        }
+        //master已经接受了连接
+        else if (batch.cmd == CMD_CONN)
+        {
+            accepted += recv_conns(users, batch, msg, list_clock);
+        }
+        //接受连接
+        else if (batch.cmd == CMD_ACCEPT)
+        {
+            load.tokens++;
+            accepted++;
+            //排空期间不再接受新连接
+            if (m_draining)
+            {
+                continue;
+            }
+            if (load.clients >= m_budget.connections)
+            {
+                metrics_add(T::m_metrics->rejected);
+                continue;
+            }
+            struct sockaddr_in raddr;
+            socklen_t raddr_len = sizeof(raddr);
+            int cfd = accept(m_lfd, (struct sockaddr *)&raddr, &raddr_len);
+            if (cfd < 0)
+            {
+                perror("accept()");
+                continue;
+            }
+            add_client(users, cfd, raddr, list_clock);
+        }
+    }
+    return false;
+}
+
+template <typename T>
+void ProcessPool<T>::handle_client(FdArena<T> &users, int sockfd, uint32_t events, ListClock &list_clock)
+{
+    WorkerLoad &load = m_load[m_idx];
+    //可读事件
+    if (events & EPOLLIN)
+    {
+        if (users[sockfd].Read())
+        {
+            //调整定时事件
+            if (users[sockfd].m_node)
+            {
+                time_t cur = time(nullptr);
+                users[sockfd].m_node->expire = cur + T::m_idle_timeout;
+                list_clock.adjust(users[sockfd].m_node);
+            }
+            users[sockfd].process(); //服务类解析request
+            if (users[sockfd].m_sockfd == -1)
+            {
+                close_client(users, sockfd, list_clock);
+            }
+            else if (users[sockfd].responding())
+            {
+                load.inflight++;
+            }
+        }
+        else
+        {
+            close_client(users, sockfd, list_clock);
+        }
+    }
+    else if (events & EPOLLOUT)
+    {
+        /*根据写的结果，决定是否关闭连接*/
+        if (!users[sockfd].Write())
+        {
+            close_client(users, sockfd, list_clock);
+        }
+        //响应发送完毕，保持连接；排空期间发送完就关闭
+        else if (!users[sockfd].responding())
+        {
+            load.inflight--;
+            if (m_draining)
+            {
+                close_client(users, sockfd, list_clock);
+            }
+        }
+    }
+    else //暂时跳过其他事件
+    {
+        close_client(users, sockfd, list_clock);
+    }
+}
+
+template <typename T>
+void ProcessPool<T>::shutdown()
+{
+    printf("master %d drain all worker process now\n", getpid());
+    m_terminated = true;
+    m_accept_pending = false;
+    m_accept_more = false;
+    //master不再accept，新连接留在监听队列中，热升级时由新的master接受
+    epoll_ctl(m_epfd, EPOLL_CTL_DEL, m_lfd, 0);
+    //worker自己会在DRAIN_TIMEOUT后退出，master多等一个周期再强制杀死
+    m_drain_deadline = time(nullptr) + DRAIN_TIMEOUT + TIMESLOT;
+    bool live = false;
+    for (int k = 0; k < m_max_process; k++)
+    {
+        if (m_workers[k].m_pid != -1)
+        {
+            send_cmd(k, CMD_STOP);
+            live = true;
+        }
+    }
+    if (!live)
+    {
+        m_stop = true;
+    }
+}
+
+template <typename T>
+void ProcessPool<T>::set_exec(int argc, const char *const argv[])
+{
+    //部署时可执行文件会被mv替换，/proc/self/exe之后指向"(deleted)"，所以在启动时记下路径
+    //不解析符号链接：切换符号链接的部署方式升级时也能启动新版本
+    char path[PATH_MAX];
+    if (argv[0][0] == '/')
+    {
+        m_exec_path = argv[0];
+    }
+    else if (strchr(argv[0], '/') && getcwd(path, sizeof(path)))
+    {
+        m_exec_path = std::string(path) + "/" + argv[0];
+    }
+    else if (realpath("/proc/self/exe", path))
+    {
+        //从PATH中找到的命令
+        m_exec_path = path;
+    }
+    m_exec_argv.assign(argv, argv + argc);
+}
+
+template <typename T>
+bool ProcessPool<T>::upgrade()
+{
+    if (m_exec_path.empty())
+    {
+        fprintf(stderr, "upgrade: executable path is unknown, call set_exec() before run()\n");
+        return false;
+    }
+    std::vector<char *> argv;
+    for (std::string &arg : m_exec_argv)
+    {
+        argv.push_back(&arg[0]);
+    }
+    argv.push_back(nullptr);
+
+    //新的master接管监听socket后向ready管道写一个字节
+    int ready[2];
+    if (pipe2(ready, O_CLOEXEC) < 0)
+    {
+        perror("pipe2()");
+        return false;
+    }
+    //m_lfd必须在exec之后依然有效
+    int flags = fcntl(m_lfd, F_GETFD);
+    fcntl(m_lfd, F_SETFD, flags & ~FD_CLOEXEC);
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        //只把m_lfd和ready的写端留给新进程
+        close(m_epfd);
+        close(sig_pipefd[0]);
+        close(sig_pipefd[1]);
+        close(ready[0]);
+        for (int k = 0; k < m_max_process; k++)
+        {
+            if (m_workers[k].m_pid != -1)
+            {
+                close(m_workers[k].m_pipefd[0]);
+            }
+        }
+        fcntl(ready[1], F_SETFD, 0);
+        char fd[16];
+        snprintf(fd, sizeof(fd), "%d", m_lfd);
+        setenv("LISTEN_FD", fd, 1);
+        snprintf(fd, sizeof(fd), "%d", ready[1]);
+        setenv("UPGRADE_READY_FD", fd, 1);
+        execv(m_exec_path.c_str(), argv.data());
+        perror("execv()");
+        _exit(1);
+    }
+    close(ready[1]);
+    //exec失败、新进程启动失败或者超时：恢复FD_CLOEXEC，旧的master继续服务
+    //等待期间master不处理事件，新的master就绪后就开始accept，连接最多在监听队列中等待UPGRADE_TIMEOUT
+    bool ok = false;
+    if (pid < 0)
+    {
+        perror("fork()");
+    }
+    else
+    {
+        struct pollfd pfd = {ready[0], POLLIN, 0};
+        char byte;
+        int ret;
+        while ((ret = poll(&pfd, 1, UPGRADE_TIMEOUT * 1000)) < 0 && errno == EINTR)
+        {
+        }
+        ok = ret > 0 && read(ready[0], &byte, 1) == 1;
+        if (!ok)
+        {
+            //没有就绪的新进程不能和旧的master同时持有监听socket
+            kill(pid, SIGKILL);
+            fprintf(stderr, "master %d upgrade: new master %d is not ready, keep serving\n", getpid(), pid);
+        }
+    }
+    close(ready[0]);
+    fcntl(m_lfd, F_SETFD, flags | FD_CLOEXEC);
+    if (ok)
+    {
+        printf("master %d upgrade: new master %d is ready\n", getpid(), pid);
+    }
+    return ok;
+}
+
+template <typename T>
+void ProcessPool<T>::notify_ready()
+{
+    if (m_ready_fd < 0)
+    {
+        return;
+    }
+    //至少一个worker完成初始化才算就绪，新的可执行文件在创建进程池或者初始化worker时失败，旧的master会继续服务
+    for (int k = 0; k < m_max_process; k++)
+    {
+        if (m_workers[k].m_pid != -1 && m_load[k].ready)
+        {
+            if (write(m_ready_fd, "1", 1) != 1)
+            {
+                perror("write ready");
+            }
+            close(m_ready_fd);
+            m_ready_fd = -1;
+            return;
+        }
+    }
+}
+
+template <typename T>
+void ProcessPool<T>::start_drain(FdArena<T> &users, ListClock &list_clock)
+{
+    if (m_draining)
+    {
+        return;
+    }
+    m_draining = true;
+    m_drain_deadline = time(nullptr) + DRAIN_TIMEOUT;
+    //之后生成的响应都带Connection: close，发送完就关闭
+    T::m_draining = true;
+    //空闲的keep-alive连接没有请求在处理，直接关闭
+    //socket中已经有还没读取的数据时不算空闲，关闭会让客户端收到RST
+    char c;
+    for (int fd = 0; fd < users.capacity(); fd++)
+    {
+        if (users.constructed(fd) && users[fd].m_node && users[fd].idle() && recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) <= 0)
+        {
+            close_client(users, fd, list_clock);
+        }
+    }
+    printf("worker %d draining, %d clients left\n", m_idx, m_load[m_idx].clients.load());
+}
+
+template <typename T>
+void ProcessPool<T>::reload()
+{
+    if (!m_reload)
+    {
+        return;
+    }
+    ReactorBudget budget = m_budget;
+    if (!m_reload(budget))
+    {
+        return;
+    }
+    //事件数组和连接数组已经按启动时的大小分配，只更新每轮的预算
+    m_budget.accepts = budget.accepts;
+    m_budget.reads = budget.reads;
+    m_budget.writes = budget.writes;
+    //之后创建的worker从master复制新的配置
+    if (m_idx == -1)
+    {
+        for (int k = 0; k < m_max_process; k++)
+        {
+            if (m_workers[k].m_pid != -1)
+            {
+                kill(m_workers[k].m_pid, SIGHUP);
+            }
+        }
+    }
 }
 
 template <typename T>
@@ -175,58 +883,247 @@ void ProcessPool<T>::init_sig_pipe()
     addsig(SIGCHLD, sig_handler);
     addsig(SIGTERM, sig_handler);
     addsig(SIGINT, sig_handler);
+    addsig(SIGHUP, sig_handler);
     addsig(SIGPIPE, SIG_IGN);
 }
 
+template <typename T>
+void ProcessPool<T>::send_cmd(int idx, int cmd)
+{
+    send(m_workers[idx].m_pipefd[0], (char *)&cmd, sizeof(cmd), 0);
+}
+
+template <typename T>
+void ProcessPool<T>::flush_batch(int idx)
+{
+    WorkerProcess &worker = m_workers[idx];
+    int n = worker.m_batch.count;
+    if (n == 0)
+    {
+        return;
+    }
+    //消息只发送用到的addrs，fd放在SCM_RIGHTS辅助数据中
+    char control[CMSG_SPACE(sizeof(int) * ConnBatch::MAX_FDS)];
+    struct iovec iov = {&worker.m_batch, offsetof(ConnBatch, addrs) + sizeof(sockaddr_in) * n};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * n);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * n);
+    memcpy(CMSG_DATA(cmsg), worker.m_batch_fds, sizeof(int) * n);
+    //不能阻塞：一个处理不过来的worker会卡住master的整个循环（accept、SIGCHLD、重新创建worker）
+    //管道满了(EAGAIN)或者接收方持有的fd太多(ETOOMANYREFS)时改发给另一个worker
+    int target = idx;
+    bool sent = sendmsg(worker.m_pipefd[0], &msg, MSG_DONTWAIT | MSG_NOSIGNAL) >= 0;
+    if (!sent)
+    {
+        target = select_worker(idx);
+        sent = target != -1 && sendmsg(m_workers[target].m_pipefd[0], &msg, MSG_DONTWAIT | MSG_NOSIGNAL) >= 0;
+        if (sent)
+        {
+            metrics_add(m_metrics->master.redispatched, n);
+        }
+    }
+    if (sent)
+    {
+        m_workers[target].m_dispatched += n;
+        metrics_add(m_metrics->master.batches);
+        //worker已经持有fd的副本，master关闭自己的
+        for (int k = 0; k < n; k++)
+        {
+            close(worker.m_batch_fds[k]);
+        }
+    }
+    else
+    {
+        metrics_add(m_metrics->master.shed, n);
+        for (int k = 0; k < n; k++)
+        {
+            shed_conn(worker.m_batch_fds[k]);
+        }
+    }
+    worker.m_batch.count = 0;
+}
+
+template <typename T>
+const char ProcessPool<T>::BUSY_RESPONSE[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length:0\r\nRetry-After:1\r\nConnection:close\r\n\r\n";
+
+template <typename T>
+void ProcessPool<T>::shed_conn(int cfd)
+{
+    //新连接的发送缓冲区是空的，一次send就能写完
+    send(cfd, BUSY_RESPONSE, sizeof(BUSY_RESPONSE) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(cfd);
+}
+
+template <typename T>
+bool ProcessPool<T>::drop_one()
+{
+    if (m_spare_fd < 0)
+    {
+        return false;
+    }
+    close(m_spare_fd);
+    int cfd = accept4(m_lfd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (cfd >= 0)
+    {
+        metrics_add(m_metrics->master.emfile);
+        shed_conn(cfd);
+    }
+    m_spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    return cfd >= 0;
+}
+
+template <typename T>
+void ProcessPool<T>::accept_conns()
+{
+    m_accept_pending = false;
+    m_accept_more = false;
+    //m_lfd是ET模式，必须一直accept到EAGAIN；超过预算时先处理信号，下一轮立即继续
+    for (int accepted = 0;; accepted++)
+    {
+        if (accepted == m_budget.accepts)
+        {
+            m_accept_more = true;
+            break;
+        }
+        int worker_id = select_worker();
+        //没有可用的worker进程（例如刚启动、都在重新创建），连接留在监听队列中，稍后再accept
+        if (worker_id == -1)
+        {
+            m_accept_pending = true;
+            break;
+        }
+        struct sockaddr_in raddr;
+        socklen_t raddr_len = sizeof(raddr);
+        int cfd = accept4(m_lfd, (struct sockaddr *)&raddr, &raddr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (cfd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            //fd用完：先把积攒的连接发给worker，释放master持有的fd；还是不够时用预留的fd取走一个连接返回503
+            //没有预留的fd或者其他错误时稍后重试，m_lfd是ET模式，不重试的话监听队列中的连接要等到下一个SYN才会被accept
+            if (errno == EMFILE || errno == ENFILE)
+            {
+                int pending = 0;
+                for (int k = 0; k < m_max_process; k++)
+                {
+                    pending += m_workers[k].m_batch.count;
+                    flush_batch(k);
+                }
+                if (pending > 0 || drop_one())
+                {
+                    continue;
+                }
+            }
+            if (errno != EMFILE && errno != ENFILE)
+            {
+                metrics_add(m_metrics->master.accept_errors);
+            }
+            m_accept_pending = true;
+            break;
+        }
+        metrics_add(m_metrics->master.accepts);
+        //优先交给绑定在处理这个连接软中断的CPU上的worker，负载不能比随机选择的高太多
+        if (CpuPlacement::instance().enabled())
+        {
+            int cpu = -1;
+            socklen_t len = sizeof(cpu);
+            if (getsockopt(cfd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == 0 && cpu >= 0)
+            {
+                int local = worker_on_cpu(cpu);
+                if (local != -1 && worker_score(local) <= worker_score(worker_id) + LOCAL_SLACK)
+                {
+                    worker_id = local;
+                    metrics_add(m_metrics->master.local_dispatch);
+                }
+            }
+        }
+        WorkerProcess &worker = m_workers[worker_id];
+        worker.m_batch.addrs[worker.m_batch.count] = raddr;
+        worker.m_batch_fds[worker.m_batch.count] = cfd;
+        if (++worker.m_batch.count == ConnBatch::MAX_FDS)
+        {
+            flush_batch(worker_id);
+        }
+    }
+    //一轮accept结束，每个worker只唤醒一次
+    for (int k = 0; k < m_max_process; k++)
+    {
+        flush_batch(k);
+    }
+}
+
 template <typename T>
 void ProcessPool<T>::run_master()
 {
     //创建epfd、注册信号、监听信号管道
     init_sig_pipe();
-    //父进程额外监听SIGALRM信号
-    //addsig(SIGALRM, sig_handler);
+    //父进程额外监听SIGALRM信号，定期检查worker的负载
+    addsig(SIGALRM, sig_handler);
+    alarm(TIMESLOT);
+    addsig(SIGUSR2, sig_handler);
     //监听m_lfd
     addfd(m_epfd, m_lfd);
-    epoll_event events[MAX_EVENT_NUMBER];
+    if (m_mode == PASS_FD)
+    {
+        m_spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+    std::vector<epoll_event> events(m_budget.events);
     int worker_id = 0;
-    int new_conn = 1;
-    int worker_process_number = m_min_process; //当前worker进程
-    int all_clients = 0;                       //记录总的连接客户数
 
     int ret = -1;
 
     while (!m_stop)
     {
-        int n = epoll_wait(m_epfd, events, MAX_EVENT_NUMBER, -1);
+        notify_ready();
+        //accept预算用完时不等待；没有可用worker时，等worker准备好之后再试；热升级时同样轮询worker是否就绪
+        int timeout = m_accept_more ? 0 : (m_accept_pending || m_ready_fd >= 0) ? ACCEPT_RETRY_MS : -1;
+        int n = epoll_wait(m_epfd, events.data(), events.size(), timeout);
         if ((n < 0) && (errno != EINTR))
         {
             perror("epoll_wait()");
             break;
         }
+        //m_lfd同时就绪时由下面的循环accept，一轮只消耗一次预算
+        bool lfd_ready = false;
+        for (int i = 0; i < n; i++)
+        {
+            lfd_ready |= events[i].data.fd == m_lfd;
+        }
+        if ((m_accept_pending || m_accept_more) && !m_terminated && !(lfd_ready && m_mode == PASS_FD))
+        {
+            accept_conns();
+        }
         for (int i = 0; i < n; i++)
         {
             int sockfd = events[i].data.fd;
-            if (sockfd == m_lfd)
+            if (sockfd == m_lfd && m_mode == PASS_FD)
+            {
+                accept_conns();
+            }
+            else if (sockfd == m_lfd)
             {
-                // int k = worker_id;
-                // do
-                // {
-                //     if (m_workers[k].m_pid != -1)
-                //     {
-                //         break;
-                //     }
-                //     k = (k + 1) % worker_id;
-                // } while (k != worker_id);
-                // if (m_workers[k].m_pid == -1) //woker进程不存在，则不分发任务
-                // {
-                //     m_stop = true; //master进程停止运行
-                //     break;
-                // }
-                // worker_id = (k + 1) % m_min_process;
                 worker_id = select_worker();
+                //没有可用的worker进程（例如都在重新创建），由下一次epoll_wait再通知
+                if (worker_id == -1)
+                {
+                    continue;
+                }
                 //使用管道通知woker_id进程
-                write(m_workers[worker_id].m_pipefd[0], (char *)&new_conn, sizeof(new_conn));
-                printf("let worker[%d] process %d accept the connection\n", worker_id, getpid());
+                send_cmd(worker_id, CMD_ACCEPT);
+                m_workers[worker_id].m_dispatched++;
             }
             else if ((sockfd == sig_pipefd[0]) && (events[i].events & EPOLLIN))
             {
@@ -243,29 +1140,33 @@ void ProcessPool<T>::run_master()
                     {
                         switch (signals[j])
                         {
-                        // case SIGALRM:
-                        // {
-                        //     //遍历每个worker进程已连接的客户数
-                        //     for (int k = 0; k < m_min_process; k++)
-                        //     {
-                        //         printf("worker[%d] has %d clients\n", m_workers[k].m_pid, m_workers[k].m_clients);
-                        //         all_clients += m_workers[k].m_clients;
-                        //     }
-                        //     printf("detective %d clients currently!\n", all_clients);
-                        //     alarm(1);
-                        // }
+                        case SIGALRM:
+                        {
+                            if (!m_terminated)
+                            {
+                                adjust_workers();
+                            }
+                            //超过排空截止时间还没有退出的worker，强制杀死
+                            else if (time(nullptr) > m_drain_deadline)
+                            {
+                                for (int k = 0; k < m_max_process; k++)
+                                {
+                                    if (m_workers[k].m_pid != -1)
+                                    {
+                                        kill(m_workers[k].m_pid, SIGKILL);
+                                    }
+                                }
+                            }
+                            alarm(TIMESLOT);
+                            break;
+                        }
                         case SIGCHLD: //子进程退出
                         {
                             pid_t pid;
                             int stat;
                             while ((pid = waitpid(-1, &stat, WNOHANG)) > 0)
                             {
-                                worker_process_number--;
-                                if (worker_process_number == 0)
-                                {
-                                    m_stop = true;
-                                }
-                                for (int k = 0; k < m_min_process; k++)
+                                for (int k = 0; k < m_max_process; k++)
                                 {
                                     /*如果进程池中第i个子进程退出了，则主进程关闭相应的通信管道，并设置相应的m_pid为-1，以标记该子进程已经退出*/
                                     if (m_workers[k].m_pid == pid)
@@ -273,24 +1174,58 @@ void ProcessPool<T>::run_master()
                                         printf("child %d exit\n", k);
                                         close(m_workers[k].m_pipefd[0]);
                                         m_workers[k].m_pid = -1;
+                                        m_load[k].ready = 0;
+                                        m_metrics->worker_pid[k] = -1;
+                                        //worker异常退出时重新创建，保证至少有m_min_process个worker
+                                        if (!m_terminated && !m_workers[k].m_retiring)
+                                        {
+                                            printf("respawn worker[%d]\n", k);
+                                            metrics_add(m_metrics->master.respawns);
+                                            if (spawn(k))
+                                            {
+                                                run_worker();
+                                                exit(0);
+                                            }
+                                        }
+                                    }
+                                }
+                            }
+                            //所有worker进程都已退出
+                            if (m_terminated)
+                            {
+                                m_stop = true;
+                                for (int k = 0; k < m_max_process; k++)
+                                {
+                                    if (m_workers[k].m_pid != -1)
+                                    {
+                                        m_stop = false;
                                     }
                                 }
                             }
                             break;
                         }
-                        //父进程中断，杀死所有进程
+                        //热升级：新的master就绪后和SIGTERM一样排空，升级失败时继续服务
+                        case SIGUSR2:
+                        {
+                            if (!m_terminated && upgrade())
+                            {
+                                shutdown();
+                            }
+                            break;
+                        }
+                        //重新加载配置，已有的连接和worker不受影响
+                        case SIGHUP:
+                        {
+                            reload();
+                            break;
+                        }
+                        //父进程中断，通知所有worker排空后退出
                         case SIGTERM:
                         case SIGINT:
                         {
-                            printf("kill all worker process now\n");
-                            for (size_t k = 0; k < m_min_process; k++)
+                            if (!m_terminated)
                             {
-                                int pid = m_workers[k].m_pid;
-                                if (pid != -1)
-                                {
-                                    int sig = -1;
-                                    write(m_workers[k].m_pipefd[0], (char *)&sig, sizeof(sig));
-                                }
+                                shutdown();
                             }
                             break;
                         }
@@ -307,6 +1242,11 @@ void ProcessPool<T>::run_master()
         }
     }
     close(m_epfd);
+    if (m_spare_fd >= 0)
+    {
+        close(m_spare_fd);
+    }
+    metrics_destroy(m_metrics_name, m_metrics);
 }
 
 template <typename T>
@@ -319,72 +1259,100 @@ void ProcessPool<T>::run_worker()
     //监听定时信号
     addsig(SIGALRM, sig_handler);
     bool timeout = false; //当SIGALRM触发时，变为true，执行定时事件
-    epoll_event events[MAX_EVENT_NUMBER];
-    //请求服务的客户
-    T *users = new T[PER_PROCESS_USER];
+    std::vector<epoll_event> events(m_budget.events);
+    //超过本轮预算、推迟到下一轮的连接，按到达的顺序处理；事件保存在连接的m_deferred中
+    std::deque<int> deferred;
+    bool cmd_pending = false; //管道中还有没读完的消息
+    //请求服务的客户：只预留虚拟地址，用到某个fd时才分配物理页
+    FdArena<T> users(m_budget.connections);
 
     //创建一个定时器容器
     ListClock list_clock;
+    //统计事件循环的繁忙比例，上报给master
+    BusyMeter busy_meter;
+    WorkerLoad &load = m_load[m_idx];
+    worker_load = &load;
+    //之后HTTPConn的计数都写到共享内存中自己的那一项
+    T::m_metrics = &m_metrics->workers()[m_idx];
+    T::m_metrics_page = m_metrics;
+    int last_cpu = -1;
 
-    assert(users);
     int ret = -1;
     alarm(TIMESLOT); //TIMESLOT秒后触发一次SIGALRM信号,pipefd[0]可读
 
+    //初始化完成，master可以开始分发连接
+    load.ready = 1;
+
     while (!m_stop)
     {
-        int n = epoll_wait(m_epfd, events, MAX_EVENT_NUMBER, -1);
+        busy_meter.sleep();
+        //还有推迟的工作时只检查新事件，不等待；排空期间定期醒来检查截止时间
+        int wait = (!deferred.empty() || cmd_pending) ? 0 : m_draining ? 1000 : -1;
+        int n = epoll_wait(m_epfd, events.data(), events.size(), wait);
+        busy_meter.wake();
+        //sched_getcpu走vDSO，每次醒来采样一次，统计迁移次数
+        int cpu = sched_getcpu();
+        if (cpu != last_cpu)
+        {
+            if (last_cpu != -1)
+            {
+                metrics_add(T::m_metrics->migrations);
+            }
+            T::m_metrics->last_cpu.store(cpu, std::memory_order_relaxed);
+            last_cpu = cpu;
+        }
         if ((n < 0) && (errno != EINTR))
         {
             perror("epoll_wait()");
             break;
         }
+        //本轮剩余的读写预算，EPOLLIN和EPOLLOUT分开计算
+        int reads = m_budget.reads, writes = m_budget.writes;
+        auto take = [&](uint32_t ev) -> bool {
+            //只有错误、挂断的事件直接处理，关闭连接的开销很小
+            if (!(ev & (EPOLLIN | EPOLLOUT)))
+            {
+                return true;
+            }
+            int &left = (ev & EPOLLIN) ? reads : writes;
+            if (left == 0)
+            {
+                return false;
+            }
+            left--;
+            return true;
+        };
+        //先处理上一轮留下的工作
+        if (cmd_pending)
+        {
+            cmd_pending = !recv_cmds(users, list_clock);
+        }
+        for (size_t k = deferred.size(); k > 0; k--)
+        {
+            int sockfd = deferred.front();
+            deferred.pop_front();
+            uint32_t ev = users[sockfd].m_deferred;
+            users[sockfd].m_deferred = 0;
+            //推迟期间连接已经被关闭（例如定时器到期）
+            if (!ev || !users[sockfd].m_node)
+            {
+                continue;
+            }
+            if (!take(ev))
+            {
+                users[sockfd].m_deferred = ev;
+                deferred.push_back(sockfd);
+                continue;
+            }
+            handle_client(users, sockfd, ev, list_clock);
+        }
         for (int i = 0; i < n; i++)
         {
             int sockfd = events[i].data.fd;
             //管道可读，说明有新客户可以连接，每个客户添加一个定时事件，处理非活动连接
             if ((sockfd == m_workers[m_idx].m_pipefd[1]) && (events[i].events & EPOLLIN))
             {
-                int client = 0;
-                ret = read(sockfd, (char *)&client, sizeof(client));
-                if (((ret < 0) && (errno != EAGAIN || errno != EINTR)) || ret == 0)
-                {
-                    continue;
-                }
-                //接受连接
-                else if (client == 1)
-                {
-                    if (m_workers[m_idx].m_clients > PER_PROCESS_USER)
-                    {
-                        printf("max client limit...\n");
-                        continue;
-                    }
-                    struct sockaddr_in raddr;
-                    socklen_t raddr_len = sizeof(raddr);
-                    int cfd = accept(m_lfd, (struct sockaddr *)&raddr, &raddr_len);
-                    if (cfd < 0)
-                    {
-                        perror("accept()");
-                        continue;
-                    }
-                    m_workers[m_idx].m_clients += 1;
-
-                    printf("worker %d accept new client....%d\n", getpid(), m_workers[m_idx].m_clients);
-                    //监听cfd
-                    addfd(m_epfd, cfd);
-                    //为该客户初始化服务
-                    users[cfd].init(m_epfd, cfd, raddr);
-
-                    //设置定时事件
-                    ListNode *node = new ListNode;
-                    node->callback = clock_func;
-                    node->client_data = &users[cfd];
-                    time_t cur = time(nullptr);
-                    node->expire = cur + 3 * TIMESLOT; //3 TIMESLOT后关闭
-
-                    users[cfd].m_node = node;
-
-                    list_clock.push(node);
-                }
+                cmd_pending = !recv_cmds(users, list_clock);
             }
             //有信号
             else if ((sig_pipefd[0] == sockfd) && (events[i].events & EPOLLIN))
@@ -418,7 +1386,12 @@ void ProcessPool<T>::run_worker()
                         case SIGTERM:
                         case SIGINT:
                         {
-                            m_stop = true;
+                            start_drain(users, list_clock);
+                            break;
+                        }
+                        case SIGHUP:
+                        {
+                            reload();
                             break;
                         }
                         default:
@@ -427,63 +1400,33 @@ void ProcessPool<T>::run_worker()
                     }
                 }
             }
-            //可读事件
-            else if (events[i].events & EPOLLIN)
+            //客户连接注册了EPOLLONESHOT，推迟处理期间不会重复触发
+            else if (take(events[i].events))
             {
-                if (users[sockfd].Read())
-                {
-                    //调整定时事件
-                    if (users[sockfd].m_node)
-                    {
-                        time_t cur = time(nullptr);
-                        users[sockfd].m_node->expire = cur + 3 * TIMESLOT;
-                        printf("adjust timer once\n");
-                        list_clock.adjust(users[sockfd].m_node);
-                    }
-                    users[sockfd].process(); //服务类解析request
-                }
-                else
-                {
-                    users[sockfd].close_conn(true);
-                    //移除定时事件
-                    if (users[sockfd].m_node)
-                    {
-                        list_clock.pop(users[sockfd].m_node);
-                    }
-                }
+                handle_client(users, sockfd, events[i].events, list_clock);
             }
-            else if (events[i].events & EPOLLOUT)
-            {
-                /*根据写的结果，决定是否关闭连接*/
-                if (!users[sockfd].Write())
-                {
-                    users[sockfd].close_conn(true);
-                    if (users[sockfd].m_node)
-                    {
-                        list_clock.pop(users[sockfd].m_node);
-                    }
-                }
-            }
-            else //暂时跳过其他事件
+            else
             {
-                users[sockfd].close_conn(true);
-                if (users[sockfd].m_node)
-                {
-                    list_clock.pop(users[sockfd].m_node);
-                }
+                users[sockfd].m_deferred = events[i].events;
+                deferred.push_back(sockfd);
             }
         }
-        //所有事件处理完毕后再执行定时事件
+        //所有事件处理完毕后再执行定时事件，并上报负载
         if (timeout)
         {
             time_handler(list_clock, m_epfd);
+            load.busy_permille = busy_meter.permille();
             timeout = false;
         }
+        //所有连接都已关闭，或者超过了排空的截止时间
+        if (m_draining && (load.clients <= 0 || time(nullptr) >= m_drain_deadline))
+        {
+            printf("worker %d drained, %d clients left\n", m_idx, load.clients.load());
+            m_stop = true;
+        }
     }
 
-    delete[] users;
-    users = nullptr;
-    close(m_workers[m_idx].m_pipefd[0]);
+    close(m_workers[m_idx].m_pipefd[1]);
     close(m_epfd);
 }
 
@@ -500,4 +1443,4 @@ void ProcessPool<T>::run()
     run_master(); //master进程执行这句
 }
 
-#endif // PROCESSPOOL_H
\ No newline at end of file
+#endif // PROCESSPOOL_H
@@ -0,0 +1,89 @@
+/**
+ * @author: fenghaze
+ * @date: 2026/10/19 15:40
+ * @desc: worker进程的负载信息
+ * 在fork之前用MAP_SHARED映射一块共享内存，每个worker只写自己的那一项，master读取所有项来决定扩容、缩容
+ */
+
+#ifndef WORKERLOAD_H
+#define WORKERLOAD_H
+
+#include <atomic>
+#include <time.h>
+#include <sys/mman.h>
+
+//每个worker独占一个cache line，避免worker之间伪共享
+struct alignas(64) WorkerLoad
+{
+    std::atomic<int> ready;         //初始化完成，可以接受连接
+    std::atomic<int> clients;       //当前连接的客户数量
+    std::atomic<int> tokens;        //已经处理的accept通知，master发出的通知数减去它就是积压数
+    std::atomic<int> inflight;      //已经生成响应、还没有发送完的请求数
+    std::atomic<int> busy_permille; //上一个统计周期内事件循环的繁忙比例（千分比）
+
+    void reset()
+    {
+        ready = 0;
+        clients = 0;
+        tokens = 0;
+        inflight = 0;
+        busy_permille = 0;
+    }
+};
+
+//跨进程共享的原子变量必须是无锁的，不能带有进程内的锁
+static_assert(sizeof(std::atomic<int>) == sizeof(int), "WorkerLoad must be usable across processes");
+
+//创建n个WorkerLoad的共享内存，fork之后master和所有worker看到的是同一块内存
+static WorkerLoad *create_worker_load(int n)
+{
+    void *addr = mmap(nullptr, sizeof(WorkerLoad) * n, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED)
+    {
+        return nullptr;
+    }
+    WorkerLoad *load = static_cast<WorkerLoad *>(addr);
+    for (int i = 0; i < n; i++)
+    {
+        load[i].reset();
+    }
+    return load;
+}
+
+//统计事件循环的繁忙比例：epoll_wait之外的时间都算作繁忙
+class BusyMeter
+{
+public:
+    BusyMeter() : m_busy(0), m_start(now()), m_wake(m_start) {}
+
+    //epoll_wait返回之后调用
+    void wake() { m_wake = now(); }
+
+    //处理完一轮事件、再次进入epoll_wait之前调用
+    void sleep() { m_busy += now() - m_wake; }
+
+    //返回从上次调用到现在的繁忙比例（千分比），并开始新的统计周期
+    int permille()
+    {
+        long long cur = now();
+        long long total = cur - m_start;
+        int ret = total > 0 ? (int)(m_busy * 1000 / total) : 0;
+        m_busy = 0;
+        m_start = cur;
+        return ret;
+    }
+
+private:
+    static long long now()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+
+    long long m_busy;
+    long long m_start;
+    long long m_wake;
+};
+
+#endif // WORKERLOAD_H
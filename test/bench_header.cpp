@@ -0,0 +1,80 @@
+/**
+ * @author: fenghaze
+ * @date: 2026/10/19 10:10
+ * @desc: 响应头生成的微基准：对比逐字段vsnprintf和HttpHeader.h中的预格式化模板
+ * 编译：g++ -O2 -std=c++14 bench_header.cpp ../log/LogStream.cpp -o bench_header
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <map>
+#include <chrono>
+#include "../threadpool/HttpHeader.h"
+
+static const int ROUNDS = 5000000;
+static const int WRITE_BUFFER_SIZE = 1024;
+
+std::map<const int, const char *> RES_CODE = {
+    {200, "OK"},
+    {400, "Bad Request"},
+    {403, "Forbidden"},
+    {404, "Not Found"},
+    {500, "Internal Error"}};
+
+static char m_write_buf[WRITE_BUFFER_SIZE];
+static int m_write_idx;
+
+//原来HttpResponse::set_response的实现
+bool set_response(const char *format, ...)
+{
+    if (m_write_idx >= WRITE_BUFFER_SIZE)
+        return false;
+    va_list arg_list;
+    va_start(arg_list, format);
+    int len = vsnprintf(m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list);
+    va_end(arg_list);
+    if (len >= (WRITE_BUFFER_SIZE - 1 - m_write_idx))
+        return false;
+    m_write_idx += len;
+    return true;
+}
+
+//原来的5次格式化：状态行、Content-Type、Content-Length、Connection、空行
+void build_vsnprintf(int status, int content_length, bool linger)
+{
+    m_write_idx = 0;
+    set_response("%s %d %s\r\n", "HTTP/1.1", status, RES_CODE[status]);
+    set_response("Content-Type:%s\r\n", "text/html");
+    set_response("Content-Length:%d\r\n", content_length);
+    set_response("Connection:%s\r\n", linger ? "keep-alive" : "close");
+    set_response("%s", "\r\n");
+}
+
+void build_template(int status, int content_length, bool linger)
+{
+    m_write_idx = header::build(m_write_buf, WRITE_BUFFER_SIZE, status, linger, content_length);
+}
+
+template <typename F>
+double bench(F f)
+{
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        f(i & 1 ? 200 : 404, i & 0xffff, i & 2);
+        //防止编译器把循环优化掉
+        asm volatile("" ::"r"(m_write_buf) : "memory");
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - begin).count() / ROUNDS;
+}
+
+int main(int argc, char const *argv[])
+{
+    double before = bench(build_vsnprintf);
+    double after = bench(build_template);
+    printf("vsnprintf: %8.2lf ns/op\n", before);
+    printf("template : %8.2lf ns/op\n", after);
+    return 0;
+}
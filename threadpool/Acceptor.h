@@ -0,0 +1,226 @@
+/**
+ * @author: fenghaze
+ * @date: 2026/10/19 20:10
+ * @desc: 监听socket的接受器
+ * lfd可读时用accept4(SOCK_NONBLOCK|SOCK_CLOEXEC)连续接受，每轮最多batch个，剩下的连接留给下一轮（lfd是LT模式）
+ * 连接数超过上限、或者fd超出连接数组时，发送预先生成的503后关闭，不会泄漏fd
+ * 预留一个/dev/null的fd：进程fd用完(EMFILE)时先释放它，接受并关闭一个连接，再重新打开，避免lfd一直可读造成忙循环
+ */
+
+#ifndef ACCEPTOR_H
+#define ACCEPTOR_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include "HttpHeader.h"
+
+class Acceptor
+{
+public:
+    //计数只由主线程修改
+    struct Stats
+    {
+        uint64_t accepted;    //交给on_conn的连接
+        uint64_t shed;        //超过连接上限或fd超出数组，返回503后关闭的连接
+        uint64_t emfile;      //fd用完时借用预留fd关闭的连接
+        uint64_t errors;      //其他accept4错误
+        uint64_t full_rounds; //一轮用完batch，监听队列中可能还有连接
+    };
+
+    //max_clients：同时服务的连接上限，也是连接数组的大小，cfd必须小于它
+    Acceptor(int lfd, int max_clients, int batch);
+    ~Acceptor();
+
+    //lfd可读时调用：on_conn(cfd, addr)接管连接，clients是当前的连接数，返回本轮接受的连接数
+    template <typename F>
+    int accept_batch(int clients, F &&on_conn);
+
+    const Stats &stats() const { return m_stats; }
+
+    //修改每轮的接受上限（SIGHUP重新加载配置）
+    void set_batch(int batch) { m_batch = batch; }
+
+    //输出计数、距上次输出的接受速率、监听队列的长度和系统的监听队列溢出次数
+    std::string report();
+
+private:
+    //fd用完时，借用预留的fd接受一个连接并立即关闭，没有关闭连接时返回false
+    bool drop_one();
+
+    //503后关闭，客户端能看到明确的拒绝，而不是一直等到超时
+    static void shed(int cfd);
+
+    //系统的TcpExt: ListenOverflows和ListenDrops，不可读时返回-1
+    static void listen_overflows(long &overflows, long &drops);
+
+private:
+    int m_lfd;
+    int m_max_clients;
+    int m_batch;
+    int m_spare_fd; //预留的fd
+    Stats m_stats;
+
+    uint64_t m_last_accepted; //上次report()时的accepted
+    time_t m_last_report;     //上次report()的时间
+};
+
+Acceptor::Acceptor(int lfd, int max_clients, int batch)
+    : m_lfd(lfd), m_max_clients(max_clients), m_batch(batch), m_last_accepted(0), m_last_report(time(nullptr))
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+Acceptor::~Acceptor()
+{
+    if (m_spare_fd >= 0)
+    {
+        close(m_spare_fd);
+    }
+}
+
+template <typename F>
+int Acceptor::accept_batch(int clients, F &&on_conn)
+{
+    int n = 0;
+    while (n < m_batch)
+    {
+        struct sockaddr_in raddr;
+        socklen_t raddr_len = sizeof(raddr);
+        int cfd = accept4(m_lfd, (struct sockaddr *)&raddr, &raddr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (cfd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            if (errno == EMFILE || errno == ENFILE)
+            {
+                //监听队列已经空了，或者没有预留的fd
+                if (!drop_one())
+                {
+                    break;
+                }
+                ++n;
+                continue;
+            }
+            m_stats.errors++;
+            break;
+        }
+        ++n;
+        if (clients >= m_max_clients || cfd >= m_max_clients)
+        {
+            m_stats.shed++;
+            shed(cfd);
+            continue;
+        }
+        m_stats.accepted++;
+        ++clients;
+        on_conn(cfd, raddr);
+    }
+    if (n == m_batch)
+    {
+        m_stats.full_rounds++;
+    }
+    return n;
+}
+
+bool Acceptor::drop_one()
+{
+    if (m_spare_fd < 0)
+    {
+        return false;
+    }
+    close(m_spare_fd);
+    int cfd = accept4(m_lfd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (cfd >= 0)
+    {
+        close(cfd);
+        m_stats.emfile++;
+    }
+    m_spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    return cfd >= 0;
+}
+
+void Acceptor::shed(int cfd)
+{
+    header::Bytes resp = header::CannedResponses::instance().get(503, false);
+    send(cfd, resp.data, resp.len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(cfd);
+}
+
+void Acceptor::listen_overflows(long &overflows, long &drops)
+{
+    overflows = drops = -1;
+    FILE *fp = fopen("/proc/net/netstat", "r");
+    if (!fp)
+    {
+        return;
+    }
+    //TcpExt:两行，第一行是字段名，第二行是对应的值
+    char names[4096], values[4096];
+    while (fgets(names, sizeof(names), fp) && fgets(values, sizeof(values), fp))
+    {
+        if (strncmp(names, "TcpExt:", 7) != 0)
+        {
+            continue;
+        }
+        char *name_save, *value_save;
+        char *name = strtok_r(names, " \n", &name_save);
+        char *value = strtok_r(values, " \n", &value_save);
+        while (name && value)
+        {
+            if (strcmp(name, "ListenOverflows") == 0)
+                overflows = atol(value);
+            else if (strcmp(name, "ListenDrops") == 0)
+                drops = atol(value);
+            name = strtok_r(nullptr, " \n", &name_save);
+            value = strtok_r(nullptr, " \n", &value_save);
+        }
+        break;
+    }
+    fclose(fp);
+}
+
+std::string Acceptor::report()
+{
+    time_t now = time(nullptr);
+    double rate = now > m_last_report ? (double)(m_stats.accepted - m_last_accepted) / (now - m_last_report) : 0;
+    m_last_accepted = m_stats.accepted;
+    m_last_report = now;
+
+    //监听socket的TCP_INFO：tcpi_unacked是等待accept的连接数，tcpi_sacked是backlog上限
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    int queued = -1, limit = -1;
+    if (getsockopt(m_lfd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0)
+    {
+        queued = info.tcpi_unacked;
+        limit = info.tcpi_sacked;
+    }
+    long overflows, drops;
+    listen_overflows(overflows, drops);
+
+    char buf[512];
+    snprintf(buf, sizeof(buf),
+             "acceptor: accepted=%llu shed=%llu emfile=%llu errors=%llu full_rounds=%llu rate=%.1f/s backlog=%d/%d listen_overflows=%ld listen_drops=%ld",
+             (unsigned long long)m_stats.accepted, (unsigned long long)m_stats.shed, (unsigned long long)m_stats.emfile,
+             (unsigned long long)m_stats.errors, (unsigned long long)m_stats.full_rounds, rate, queued, limit, overflows, drops);
+    return buf;
+}
+
+#endif // ACCEPTOR_H
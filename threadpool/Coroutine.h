@@ -0,0 +1,433 @@
+/**
+ * @author: fenghaze
+ * @date: 2026/10/19 23:10
+ * @desc: 基于epoll反应堆的C++20协程运行时，编译时打开ENABLE_COROUTINE(cmake -DENABLE_COROUTINE=ON)才可用
+ * Task：立即开始执行、执行完自动释放的协程，协程帧从当前线程的FramePool分配，用完放回空闲链表
+ * Scheduler：在主线程的事件循环中使用，fd就绪、定时器到期、其他线程post()时恢复等待的协程
+ * Conn：连接上的awaitable，co_await read_some()/write_all()/sleep_for()，不能立即完成时注册EPOLLONESHOT事件后挂起
+ * 协程只在Scheduler所在的线程中恢复，其他线程（例如crypto线程池）通过post()把协程交还给主线程
+ * 连接的状态保存在协程帧的局部变量中，不需要在对象中保存读写进度
+ */
+
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+#if defined(ENABLE_COROUTINE) && defined(__cpp_impl_coroutine)
+#define HAVE_COROUTINE 1
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <coroutine>
+#include <exception>
+#include <queue>
+#include <vector>
+#include "Histogram.h"
+#include "../utils/utils.h"
+#include "../lock/locker.h"
+
+namespace coro
+{
+    //协程帧的内存池：按64字节分级的空闲链表，每个线程一份，不加锁
+    //连接的协程帧大小相同，释放后马上被下一个连接复用，稳定后不再调用malloc
+    class FramePool
+    {
+    public:
+        static void *allocate(size_t size);
+        static void deallocate(void *p, size_t size);
+
+    private:
+        static const size_t GRANULE = 64;
+        static const int CLASSES = 64;  //不超过4KB的帧使用空闲链表，更大的直接malloc
+        static const int MAX_CACHED = 1024; //每一级最多缓存的空闲帧
+
+        struct Block
+        {
+            Block *next;
+        };
+        struct Lists
+        {
+            Block *head[CLASSES] = {};
+            int cached[CLASSES] = {};
+            ~Lists();
+        };
+        static Lists &lists()
+        {
+            thread_local Lists mLists;
+            return mLists;
+        }
+    };
+
+    //分离的协程：创建后立即执行到第一个co_await，结束时自动释放协程帧
+    struct Task
+    {
+        struct promise_type
+        {
+            Task get_return_object() { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() {}
+            //连接处理函数不抛出异常，出现异常说明程序有错误
+            void unhandled_exception() { std::terminate(); }
+
+            static void *operator new(size_t size) { return FramePool::allocate(size); }
+            static void operator delete(void *p, size_t size) { FramePool::deallocate(p, size); }
+        };
+    };
+
+    //等待fd就绪的awaitable，fd就绪时Scheduler调用ready()
+    struct Waiter
+    {
+        std::coroutine_handle<> handle;
+        virtual void ready() = 0;
+        virtual ~Waiter() {}
+    };
+
+    class Scheduler
+    {
+    public:
+        //fd的上限和连接数组的大小相同
+        Scheduler(int epfd, int max_fds);
+        ~Scheduler();
+
+        //挂起的协程在fd上等待events(EPOLLIN或EPOLLOUT)
+        void wait(int fd, uint32_t events, Waiter *waiter);
+
+        //epoll返回fd上的事件时调用：恢复等待的协程，没有协程在等待时返回false
+        bool on_event(int fd);
+
+        //挂起的协程在deadline(微秒，monotonic_us())之后恢复
+        void sleep(uint64_t deadline, std::coroutine_handle<> handle);
+
+        //距离最近的定时器还有多少毫秒，没有定时器时返回def，用作epoll_wait的超时
+        int next_timeout(int def) const;
+
+        //恢复所有到期的协程
+        void run_timers();
+
+        //其他线程调用：把协程交还给主线程，由run_posted()恢复
+        void post(std::coroutine_handle<> handle);
+
+        //eventfd可读时调用，恢复其他线程交还的协程
+        void run_posted();
+
+        //注册到epoll中的eventfd，其他线程post()时可读
+        int event_fd() const { return m_eventfd; }
+
+        //SIGTERM：协程处理完当前的请求后退出，不再读取新的请求
+        void stop() { m_stopping = true; }
+        bool stopping() const { return m_stopping; }
+
+        int epfd() const { return m_epfd; }
+
+    private:
+        struct Timer
+        {
+            uint64_t deadline;
+            std::coroutine_handle<> handle;
+            bool operator>(const Timer &other) const { return deadline > other.deadline; }
+        };
+
+        int m_epfd;
+        int m_eventfd;
+        bool m_stopping;
+        std::vector<Waiter *> m_waiters; //按fd索引的等待者
+        std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> m_timers;
+        locker m_postlocker;                            //保护m_posted
+        std::vector<std::coroutine_handle<>> m_posted;  //其他线程交还的协程
+        std::vector<std::coroutine_handle<>> m_running; //run_posted()正在恢复的协程，和m_posted交换，避免每次分配
+    };
+
+    //连接上的awaitable，fd是非阻塞的，由协程负责关闭
+    class Conn
+    {
+    public:
+        Conn(Scheduler &sched, int fd) : m_sched(sched), m_fd(fd) {}
+
+        //读取最多len字节：返回读到的字节数，0表示对端关闭，-1表示出错
+        struct ReadAwaiter : Waiter
+        {
+            Scheduler &sched;
+            int fd;
+            char *buf;
+            size_t len;
+            ssize_t n;
+
+            ReadAwaiter(Scheduler &s, int f, char *b, size_t l) : sched(s), fd(f), buf(b), len(l), n(-1) {}
+            bool await_ready()
+            {
+                n = recv(fd, buf, len, 0);
+                return n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+            }
+            void await_suspend(std::coroutine_handle<> h)
+            {
+                handle = h;
+                sched.wait(fd, EPOLLIN, this);
+            }
+            void ready() override
+            {
+                //对端关闭、出错时recv会立即返回；没有数据（虚假唤醒）时继续等待
+                if (await_ready())
+                    handle.resume();
+                else
+                    sched.wait(fd, EPOLLIN, this);
+            }
+            ssize_t await_resume() { return n; }
+        };
+
+        //发送iov中的所有数据，iov会被修改；每轮最多发送quantum字节，超过后等下一轮EPOLLOUT，避免大文件占住主线程
+        //返回是否发送完毕，false表示连接出错
+        struct WriteAwaiter : Waiter
+        {
+            Scheduler &sched;
+            int fd;
+            struct iovec *iov;
+            int iovcnt;
+            size_t quantum;
+            bool ok;
+
+            WriteAwaiter(Scheduler &s, int f, struct iovec *v, int c, size_t q) : sched(s), fd(f), iov(v), iovcnt(c), quantum(q), ok(true) {}
+            bool await_ready() { return step(); }
+            void await_suspend(std::coroutine_handle<> h)
+            {
+                handle = h;
+                sched.wait(fd, EPOLLOUT, this);
+            }
+            void ready() override
+            {
+                if (step())
+                    handle.resume();
+                else
+                    sched.wait(fd, EPOLLOUT, this);
+            }
+            bool await_resume() { return ok; }
+
+            //发送到EAGAIN、出错、发送完毕或者用完quantum，发送完毕或者出错时返回true
+            bool step();
+        };
+
+        //等待ms毫秒
+        struct SleepAwaiter
+        {
+            Scheduler &sched;
+            uint64_t deadline;
+
+            bool await_ready() { return monotonic_us() >= deadline; }
+            void await_suspend(std::coroutine_handle<> h) { sched.sleep(deadline, h); }
+            void await_resume() {}
+        };
+
+        ReadAwaiter read_some(char *buf, size_t len) { return ReadAwaiter(m_sched, m_fd, buf, len); }
+        WriteAwaiter write_all(struct iovec *iov, int iovcnt, size_t quantum = 256 * 1024)
+        {
+            return WriteAwaiter(m_sched, m_fd, iov, iovcnt, quantum);
+        }
+        SleepAwaiter sleep_for(int ms) { return SleepAwaiter{m_sched, monotonic_us() + ms * 1000ULL}; }
+
+        int fd() const { return m_fd; }
+
+    private:
+        Scheduler &m_sched;
+        int m_fd;
+    };
+
+    void *FramePool::allocate(size_t size)
+    {
+        size_t idx = (size - 1) / GRANULE;
+        if (idx >= (size_t)CLASSES)
+        {
+            return ::operator new(size);
+        }
+        Lists &l = lists();
+        Block *b = l.head[idx];
+        if (b)
+        {
+            l.head[idx] = b->next;
+            l.cached[idx]--;
+            return b;
+        }
+        return ::operator new((idx + 1) * GRANULE);
+    }
+
+    void FramePool::deallocate(void *p, size_t size)
+    {
+        size_t idx = (size - 1) / GRANULE;
+        if (idx >= (size_t)CLASSES)
+        {
+            ::operator delete(p);
+            return;
+        }
+        Lists &l = lists();
+        if (l.cached[idx] >= MAX_CACHED)
+        {
+            ::operator delete(p);
+            return;
+        }
+        Block *b = (Block *)p;
+        b->next = l.head[idx];
+        l.head[idx] = b;
+        l.cached[idx]++;
+    }
+
+    FramePool::Lists::~Lists()
+    {
+        for (int i = 0; i < CLASSES; i++)
+        {
+            while (head[i])
+            {
+                Block *b = head[i];
+                head[i] = b->next;
+                ::operator delete(b);
+            }
+        }
+    }
+
+    Scheduler::Scheduler(int epfd, int max_fds)
+        : m_epfd(epfd), m_stopping(false), m_waiters(max_fds, nullptr)
+    {
+        m_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (m_eventfd < 0)
+        {
+            throw std::exception();
+        }
+        addfd(m_epfd, m_eventfd, false);
+    }
+
+    Scheduler::~Scheduler()
+    {
+        //退出时还在等待的协程（空闲的keep-alive连接等）直接销毁，释放协程帧
+        for (Waiter *w : m_waiters)
+        {
+            if (w)
+                w->handle.destroy();
+        }
+        while (!m_timers.empty())
+        {
+            m_timers.top().handle.destroy();
+            m_timers.pop();
+        }
+        for (std::coroutine_handle<> h : m_posted)
+        {
+            h.destroy();
+        }
+        delfd(m_epfd, m_eventfd);
+    }
+
+    void Scheduler::wait(int fd, uint32_t events, Waiter *waiter)
+    {
+        m_waiters[fd] = waiter;
+        modfd(m_epfd, fd, events);
+    }
+
+    bool Scheduler::on_event(int fd)
+    {
+        Waiter *w = m_waiters[fd];
+        if (!w)
+        {
+            return false;
+        }
+        m_waiters[fd] = nullptr;
+        w->ready();
+        return true;
+    }
+
+    void Scheduler::sleep(uint64_t deadline, std::coroutine_handle<> handle)
+    {
+        m_timers.push(Timer{deadline, handle});
+    }
+
+    int Scheduler::next_timeout(int def) const
+    {
+        if (m_timers.empty())
+        {
+            return def;
+        }
+        uint64_t now = monotonic_us();
+        uint64_t deadline = m_timers.top().deadline;
+        //向上取整，避免定时器还差不到1毫秒时epoll_wait(0)忙等
+        int ms = deadline > now ? (int)((deadline - now + 999) / 1000) : 0;
+        return def >= 0 && def < ms ? def : ms;
+    }
+
+    void Scheduler::run_timers()
+    {
+        uint64_t now = monotonic_us();
+        while (!m_timers.empty() && m_timers.top().deadline <= now)
+        {
+            std::coroutine_handle<> h = m_timers.top().handle;
+            m_timers.pop();
+            h.resume();
+        }
+    }
+
+    void Scheduler::post(std::coroutine_handle<> handle)
+    {
+        m_postlocker.lock();
+        m_posted.push_back(handle);
+        m_postlocker.unlock();
+        uint64_t one = 1;
+        ::write(m_eventfd, &one, sizeof(one));
+    }
+
+    void Scheduler::run_posted()
+    {
+        uint64_t count;
+        while (::read(m_eventfd, &count, sizeof(count)) > 0)
+        {
+        }
+        m_postlocker.lock();
+        m_running.swap(m_posted);
+        m_postlocker.unlock();
+        for (std::coroutine_handle<> h : m_running)
+        {
+            h.resume();
+        }
+        m_running.clear();
+    }
+
+    bool Conn::WriteAwaiter::step()
+    {
+        size_t sent = 0;
+        while (iovcnt > 0)
+        {
+            if (sent >= quantum)
+            {
+                return false;
+            }
+            ssize_t n = writev(fd, iov, iovcnt);
+            if (n < 0)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    return false;
+                }
+                ok = false;
+                return true;
+            }
+            sent += n;
+            //跳过已经发送完的向量，调整剩下的第一个向量
+            while (iovcnt > 0 && (size_t)n >= iov->iov_len)
+            {
+                n -= iov->iov_len;
+                iov++;
+                iovcnt--;
+            }
+            if (iovcnt > 0)
+            {
+                iov->iov_base = (char *)iov->iov_base + n;
+                iov->iov_len -= n;
+            }
+        }
+        return true;
+    }
+
+} // end of namespace coro
+
+#endif // ENABLE_COROUTINE && __cpp_impl_coroutine
+
+#endif // COROUTINE_H
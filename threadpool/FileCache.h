@@ -0,0 +1,404 @@
+/**
+ * @author: fenghaze
+ * @date: 2026/10/20 00:40
+ * @desc: 静态文件缓存和预压缩
+ * 不超过file_cache_max_kb的文件第一次请求时读入内存，之后的请求直接发送缓存中的内容，不再stat/open/mmap
+ * 可压缩的文件在填充缓存时交给压缩线程池(threadpool2.h的Executor)，生成gzip（和brotli）版本，和原文保存在同一个条目中；
+ * 压缩完成之前发送原文，压缩后没有明显变小的版本直接丢弃
+ * 条目最多每秒stat一次，文件被修改后删除旧条目，正在发送旧条目的请求持有shared_ptr，不受影响
+ * 缓存总大小超过file_cache_mb后不再填充新文件，超过大小的文件和缓存满时仍然使用mmap
+ * Content-Type和Cache-Control、ETag、Last-Modified字段在填充时按每个版本生成一次，命中的请求直接拷贝；
+ * 完整的304响应也在填充时生成，验证通过的条件请求直接发送，不拷贝也不访问文件
+ */
+
+#ifndef FILECACHE_H
+#define FILECACHE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+#include <map>
+#include <string>
+#include <memory>
+#include <atomic>
+#include "threadpool2.h"
+#include "MimeTypes.h"
+#include "../lock/locker.h"
+#include "../log/AsyncLogger.h"
+#include "../log/Logger.h"
+
+//响应体的编码，Accept-Encoding解析成以编码为位的掩码
+enum ENCODING
+{
+    ENCODING_IDENTITY = 0,
+    ENCODING_GZIP,
+    ENCODING_BR,
+    ENCODING_NUM
+};
+
+//一个缓存的文件：原文和压缩后的版本
+struct CacheEntry
+{
+    std::string path;
+    struct stat st;                      //填充时的文件属性，用于检查文件是否被修改
+    std::atomic<time_t> checked;         //上次stat的时间(秒)
+    const mime::Type *type;              //按扩展名得到的类型，决定Content-Type和是否压缩
+    std::string body[ENCODING_NUM];      //body[ENCODING_IDENTITY]是原文，其他版本由压缩线程写入
+    std::string fields[ENCODING_NUM];    //每个版本Content-Type之后的响应头字段，填充时生成
+    std::string etag[ENCODING_NUM];      //每个版本的ETag（含引号），用于比较If-None-Match
+    std::string not_modified[ENCODING_NUM][2]; //每个版本完整的304响应，[0:close 1:keep-alive]
+    std::atomic<bool> ready[ENCODING_NUM]; //压缩版本是否可用，写入body之后以release置位
+};
+
+class FileCache
+{
+public:
+    static FileCache &instance()
+    {
+        static FileCache mInstance;
+        return mInstance;
+    }
+
+    //缓存上限、单个文件上限(字节)、gzip级别和brotli质量(0表示不生成)、Cache-Control的max-age(秒)，启动时和SIGHUP时调用
+    void configure(size_t max_bytes, size_t max_file, int gzip_level, int brotli_quality, int max_age);
+
+    //压缩任务交给executor执行，没有设置时不压缩
+    void set_executor(Executor *executor) { m_executor = executor; }
+
+    //网站根目录：只缓存真实路径在根目录下的文件，符号链接指向根目录之外的文件不缓存
+    void set_root(const char *root);
+
+    //查找缓存：条目存在且文件没有被修改时返回条目，否则返回空指针
+    std::shared_ptr<CacheEntry> lookup(const char *path);
+
+    //已经检查过属性的文件：读入缓存并提交压缩任务；文件太大、缓存已满或者读取失败时返回空指针
+    std::shared_ptr<CacheEntry> fill(const char *path, const struct stat &st);
+
+    //启动时预先加载路由注册的文件
+    void preload(const char *path);
+
+    //生成Cache-Control、ETag、Last-Modified字段，压缩版本再加上Content-Encoding，vary时加上Vary
+    //not_modified表示用于304响应，不带Content-Encoding；返回写入的长度，空间不足时返回-1
+    //不在缓存中的大文件每次请求时调用
+    int format_fields(char *buf, size_t cap, const struct stat &st, int encoding, bool vary, bool not_modified = false) const;
+
+    //强ETag："inode-大小-修改时间"，每个编码的版本加上不同的后缀；返回写入的长度
+    static int format_etag(char *buf, size_t cap, const struct stat &st, int encoding);
+
+    //命中、填充、绕过缓存的次数和缓存大小
+    std::string report() const;
+
+private:
+    FileCache() : m_max_bytes(0), m_max_file(0), m_gzip_level(0), m_brotli_quality(0), m_max_age(0), m_executor(nullptr),
+                  m_bytes(0), m_hits(0), m_misses(0), m_fills(0), m_bypass(0), m_compressed(0) {}
+
+    //在压缩线程中执行：生成压缩版本
+    void compress(const std::shared_ptr<CacheEntry> &entry, int gzip_level, int brotli_quality);
+
+    //真实路径是否在m_root下
+    bool under_root(const char *path) const;
+
+    static bool gzip(const std::string &in, std::string &out, int level);
+#ifdef HAVE_BROTLI
+    static bool brotli(const std::string &in, std::string &out, int quality);
+#endif
+
+private:
+    //小于这个大小的文件压缩后几乎不会变小
+    static const size_t MIN_COMPRESS = 256;
+
+    //std::less<>支持直接用const char*查找，不构造std::string
+    std::map<std::string, std::shared_ptr<CacheEntry>, std::less<>> m_entries;
+    mutable rwlocker m_lock;
+    std::string m_root; //网站根目录的真实路径，以'/'结尾，启动时设置
+
+    std::atomic<size_t> m_max_bytes;
+    std::atomic<size_t> m_max_file;
+    std::atomic<int> m_gzip_level;
+    std::atomic<int> m_brotli_quality;
+    std::atomic<int> m_max_age;
+    Executor *m_executor;
+
+    std::atomic<size_t> m_bytes; //原文和压缩版本的总大小
+    std::atomic<uint64_t> m_hits;
+    std::atomic<uint64_t> m_misses;
+    std::atomic<uint64_t> m_fills;
+    std::atomic<uint64_t> m_bypass;     //太大、缓存已满或者不在根目录下，使用mmap
+    std::atomic<uint64_t> m_compressed; //生成的压缩版本
+};
+
+void FileCache::configure(size_t max_bytes, size_t max_file, int gzip_level, int brotli_quality, int max_age)
+{
+    m_max_age = max_age;
+    m_max_bytes = max_bytes;
+    m_max_file = max_file;
+    m_gzip_level = gzip_level;
+    m_brotli_quality = brotli_quality;
+}
+
+void FileCache::set_root(const char *root)
+{
+    char real[PATH_MAX];
+    m_root = realpath(root, real) ? real : root;
+    if (m_root.empty() || m_root.back() != '/')
+        m_root += '/';
+}
+
+bool FileCache::under_root(const char *path) const
+{
+    char real[PATH_MAX];
+    return !m_root.empty() && realpath(path, real) && strncmp(real, m_root.data(), m_root.size()) == 0;
+}
+
+std::shared_ptr<CacheEntry> FileCache::lookup(const char *path)
+{
+    std::shared_ptr<CacheEntry> entry;
+    m_lock.rdlock();
+    auto it = m_entries.find(path);
+    if (it != m_entries.end())
+        entry = it->second;
+    m_lock.unlock();
+    if (!entry)
+    {
+        m_misses++;
+        return entry;
+    }
+
+    //最多每秒检查一次文件是否被修改、删除或者改变了权限
+    time_t now = time(nullptr);
+    time_t checked = entry->checked.load(std::memory_order_relaxed);
+    if (now != checked && entry->checked.compare_exchange_strong(checked, now, std::memory_order_relaxed))
+    {
+        struct stat st;
+        if (stat(path, &st) < 0 || st.st_ino != entry->st.st_ino || st.st_size != entry->st.st_size ||
+            st.st_mtime != entry->st.st_mtime || st.st_mode != entry->st.st_mode)
+        {
+            m_lock.wrlock();
+            it = m_entries.find(path);
+            if (it != m_entries.end() && it->second == entry)
+            {
+                m_entries.erase(it);
+                for (int i = 0; i < ENCODING_NUM; i++)
+                {
+                    if (i == ENCODING_IDENTITY || entry->ready[i].load(std::memory_order_acquire))
+                        m_bytes -= entry->body[i].size();
+                }
+            }
+            m_lock.unlock();
+            LOG_INFO << "file cache: " << path << " changed, reload";
+            m_misses++;
+            return nullptr;
+        }
+    }
+    m_hits++;
+    return entry;
+}
+
+std::shared_ptr<CacheEntry> FileCache::fill(const char *path, const struct stat &st)
+{
+    size_t size = st.st_size;
+    if (size > m_max_file || m_bytes + size > m_max_bytes || !under_root(path))
+    {
+        m_bypass++;
+        return nullptr;
+    }
+
+    //在锁外读入文件
+    std::shared_ptr<CacheEntry> entry = std::make_shared<CacheEntry>();
+    entry->path = path;
+    entry->st = st;
+    entry->checked = time(nullptr);
+    entry->type = &mime::lookup(path);
+    int gzip_level = m_gzip_level, brotli_quality = m_brotli_quality;
+    bool precompress = entry->type->compressible && size >= MIN_COMPRESS && (gzip_level > 0 || brotli_quality > 0) && m_executor;
+    for (int i = 0; i < ENCODING_NUM; i++)
+    {
+        entry->ready[i] = (i == ENCODING_IDENTITY);
+        //会生成压缩版本的文件，原文也要带上Vary
+        char buf[256];
+        int len = format_fields(buf, sizeof(buf), st, i, precompress);
+        entry->fields[i].assign(buf, len > 0 ? len : 0);
+        len = format_etag(buf, sizeof(buf), st, i);
+        entry->etag[i].assign(buf, len > 0 ? len : 0);
+        len = format_fields(buf, sizeof(buf), st, i, precompress, true);
+        header::Bytes fields = {buf, (size_t)(len > 0 ? len : 0)};
+        for (int linger = 0; linger < 2; linger++)
+        {
+            char head[384];
+            len = header::build_not_modified(head, sizeof(head), linger, fields);
+            entry->not_modified[i][linger].assign(head, len > 0 ? len : 0);
+        }
+    }
+    entry->body[ENCODING_IDENTITY].resize(size);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+    size_t got = 0;
+    while (got < size)
+    {
+        ssize_t n = read(fd, &entry->body[ENCODING_IDENTITY][got], size - got);
+        if (n <= 0)
+            break;
+        got += n;
+    }
+    close(fd);
+    if (got != size)
+        return nullptr;
+
+    //多个线程同时填充同一个文件时只保留第一个
+    m_lock.wrlock();
+    auto res = m_entries.emplace(path, entry);
+    if (!res.second)
+    {
+        entry = res.first->second;
+        m_lock.unlock();
+        return entry;
+    }
+    m_bytes += size;
+    m_lock.unlock();
+    m_fills++;
+
+    if (precompress)
+    {
+        //压缩队列已满时只发送原文
+        if (!m_executor->post([this, entry, gzip_level, brotli_quality] { compress(entry, gzip_level, brotli_quality); }))
+            LOG_WARN << "file cache: compress queue is full, " << path << " is sent uncompressed";
+    }
+    return entry;
+}
+
+void FileCache::preload(const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) < 0 || !(st.st_mode & S_IROTH) || S_ISDIR(st.st_mode))
+        return;
+    if (!lookup(path))
+        fill(path, st);
+}
+
+void FileCache::compress(const std::shared_ptr<CacheEntry> &entry, int gzip_level, int brotli_quality)
+{
+    const std::string &in = entry->body[ENCODING_IDENTITY];
+    std::string out[ENCODING_NUM];
+    bool ok[ENCODING_NUM] = {false};
+    //压缩后至少小10%才值得客户端解压
+    size_t worth = in.size() - in.size() / 10;
+    if (gzip_level > 0)
+        ok[ENCODING_GZIP] = gzip(in, out[ENCODING_GZIP], gzip_level) && out[ENCODING_GZIP].size() < worth;
+#ifdef HAVE_BROTLI
+    if (brotli_quality > 0)
+        ok[ENCODING_BR] = brotli(in, out[ENCODING_BR], brotli_quality) && out[ENCODING_BR].size() < worth;
+#else
+    (void)brotli_quality;
+#endif
+
+    //在锁内发布：条目已经被删除时不计入缓存大小
+    m_lock.wrlock();
+    auto it = m_entries.find(entry->path);
+    bool cached = it != m_entries.end() && it->second == entry;
+    for (int i = ENCODING_IDENTITY + 1; i < ENCODING_NUM; i++)
+    {
+        if (!ok[i])
+            continue;
+        entry->body[i].swap(out[i]);
+        entry->ready[i].store(true, std::memory_order_release);
+        if (cached)
+            m_bytes += entry->body[i].size();
+        m_compressed++;
+    }
+    m_lock.unlock();
+    LOG_INFO << "file cache: compress " << entry->path.c_str() << " " << (long)in.size()
+             << " gzip=" << (long)(ok[ENCODING_GZIP] ? entry->body[ENCODING_GZIP].size() : 0)
+             << " br=" << (long)(ok[ENCODING_BR] ? entry->body[ENCODING_BR].size() : 0);
+}
+
+int FileCache::format_etag(char *buf, size_t cap, const struct stat &st, int encoding)
+{
+    static const char *const suffix[] = {"", "-gz", "-br"};
+    int len = snprintf(buf, cap, "\"%lx-%lx-%lx%s\"", (unsigned long)st.st_ino, (unsigned long)st.st_size,
+                       (unsigned long)st.st_mtime, suffix[encoding]);
+    return len < 0 || (size_t)len >= cap ? -1 : len;
+}
+
+int FileCache::format_fields(char *buf, size_t cap, const struct stat &st, int encoding, bool vary, bool not_modified) const
+{
+    //Last-Modified使用RFC 7231的IMF-fixdate，不依赖locale
+    static const char *const days[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+    static const char *const months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+    struct tm tm;
+    gmtime_r(&st.st_mtime, &tm);
+    int max_age = m_max_age;
+    char cache_control[48];
+    if (max_age > 0)
+        snprintf(cache_control, sizeof(cache_control), "public, max-age=%d", max_age);
+    else
+        strcpy(cache_control, "no-cache");
+    char etag[64];
+    if (format_etag(etag, sizeof(etag), st, encoding) < 0)
+        return -1;
+    bool encoded = encoding != ENCODING_IDENTITY;
+    const header::Bytes &extra = encoded && !not_modified ? header::kContentEncoding[encoding]
+                                 : encoded || vary        ? header::kVary
+                                                          : header::kNoHeader;
+    int len = snprintf(buf, cap, "Cache-Control:%s\r\nETag:%s\r\nLast-Modified:%s, %02d %s %04d %02d:%02d:%02d GMT\r\n%.*s",
+                       cache_control, etag, days[tm.tm_wday], tm.tm_mday, months[tm.tm_mon], tm.tm_year + 1900,
+                       tm.tm_hour, tm.tm_min, tm.tm_sec, (int)extra.len, extra.data);
+    return len < 0 || (size_t)len >= cap ? -1 : len;
+}
+
+bool FileCache::gzip(const std::string &in, std::string &out, int level)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    //windowBits加16生成gzip格式而不是zlib格式
+    if (deflateInit2(&zs, level, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+    out.resize(deflateBound(&zs, in.size()));
+    zs.next_in = (Bytef *)in.data();
+    zs.avail_in = in.size();
+    zs.next_out = (Bytef *)&out[0];
+    zs.avail_out = out.size();
+    int ret = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return ret == Z_STREAM_END;
+}
+
+#ifdef HAVE_BROTLI
+bool FileCache::brotli(const std::string &in, std::string &out, int quality)
+{
+    size_t len = BrotliEncoderMaxCompressedSize(in.size());
+    if (len == 0)
+        return false;
+    out.resize(len);
+    if (!BrotliEncoderCompress(quality, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, in.size(), (const uint8_t *)in.data(),
+                               &len, (uint8_t *)&out[0]))
+        return false;
+    out.resize(len);
+    return true;
+}
+#endif
+
+std::string FileCache::report() const
+{
+    m_lock.rdlock();
+    size_t files = m_entries.size();
+    m_lock.unlock();
+    char buf[256];
+    snprintf(buf, sizeof(buf), "file_cache: files=%zu bytes=%zu hits=%llu misses=%llu fills=%llu bypass=%llu compressed=%llu",
+             files, m_bytes.load(), (unsigned long long)m_hits.load(), (unsigned long long)m_misses.load(),
+             (unsigned long long)m_fills.load(), (unsigned long long)m_bypass.load(), (unsigned long long)m_compressed.load());
+    return buf;
+}
+
+#endif // FILECACHE_H
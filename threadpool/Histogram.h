@@ -0,0 +1,132 @@
+/**
+ * @author: fenghaze
+ * @date: 2026/10/19 22:30
+ * @desc: 延迟直方图：多个线程并发记录，只用relaxed原子操作，不加锁
+ * 每个2的幂区间再平均分成4个bucket，相对误差不超过25%；小于4的值单独一个bucket
+ * percentile()返回所在bucket的上界，用于报告排队时间的p50/p99等
+ */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <atomic>
+#include <string>
+
+//单调时钟(微秒)
+inline uint64_t monotonic_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+class Histogram
+{
+public:
+    Histogram() : m_count(0), m_max(0)
+    {
+        for (int i = 0; i < BUCKETS; i++)
+        {
+            m_buckets[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void record(uint64_t value);
+
+    //p为0~100，没有记录时返回0
+    uint64_t percentile(double p) const;
+
+    uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+    uint64_t max() const { return m_max.load(std::memory_order_relaxed); }
+
+    //"name: count=.. p50=.. p90=.. p99=.. p999=.. max=.."
+    std::string summary(const char *name, const char *unit) const;
+
+private:
+    static const int SUB_BUCKETS = 4;
+    static const int BUCKETS = 64 * SUB_BUCKETS;
+
+    static int index(uint64_t value);
+    static uint64_t upper(int idx);
+
+private:
+    std::atomic<uint64_t> m_buckets[BUCKETS];
+    std::atomic<uint64_t> m_count;
+    std::atomic<uint64_t> m_max;
+};
+
+int Histogram::index(uint64_t value)
+{
+    if (value < SUB_BUCKETS)
+    {
+        return (int)value;
+    }
+    //最高位是第b位，取最高的3位决定区间内的bucket
+    int b = 63 - __builtin_clzll(value);
+    int m = (int)(value >> (b - 2)); //4~7
+    return (b - 1) * SUB_BUCKETS + (m - SUB_BUCKETS);
+}
+
+uint64_t Histogram::upper(int idx)
+{
+    if (idx < SUB_BUCKETS)
+    {
+        return idx;
+    }
+    int b = idx / SUB_BUCKETS + 1;
+    uint64_t m = idx % SUB_BUCKETS + SUB_BUCKETS;
+    return ((m + 1) << (b - 2)) - 1;
+}
+
+void Histogram::record(uint64_t value)
+{
+    m_buckets[index(value)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    uint64_t cur = m_max.load(std::memory_order_relaxed);
+    while (value > cur && !m_max.compare_exchange_weak(cur, value, std::memory_order_relaxed))
+    {
+    }
+}
+
+uint64_t Histogram::percentile(double p) const
+{
+    uint64_t total = count();
+    if (total == 0)
+    {
+        return 0;
+    }
+    //第rank个值所在的bucket，rank从1开始
+    uint64_t rank = (uint64_t)(total * p / 100.0 + 0.5);
+    if (rank == 0)
+    {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++)
+    {
+        seen += m_buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank)
+        {
+            //bucket的上界可能超过实际的最大值
+            uint64_t up = upper(i);
+            return up < max() ? up : max();
+        }
+    }
+    return max();
+}
+
+std::string Histogram::summary(const char *name, const char *unit) const
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s: count=%llu p50=%llu%s p90=%llu%s p99=%llu%s p999=%llu%s max=%llu%s",
+             name, (unsigned long long)count(),
+             (unsigned long long)percentile(50), unit, (unsigned long long)percentile(90), unit,
+             (unsigned long long)percentile(99), unit, (unsigned long long)percentile(99.9), unit,
+             (unsigned long long)max(), unit);
+    return buf;
+}
+
+#endif // HISTOGRAM_H
@@ -0,0 +1,198 @@
+/**
+ * @author: fenghaze
+ * @date: 2026/10/19 09:30
+ * @desc: 预先格式化的HTTP响应头模板
+ * 状态行和Connection字段在编译期拼接成只读字节串，生成响应头时只需要memcpy，
+ * 唯一需要格式化的Content-Length数字使用clog::detail::convert转换，不再逐个字段调用vsnprintf
+ */
+
+#ifndef HTTPHEADER_H
+#define HTTPHEADER_H
+
+#include <stddef.h>
+#include <string.h>
+#include "../log/LogStream.h"
+
+namespace header
+{
+    //一段只读字节：模板、字段等
+    struct Bytes
+    {
+        const char *data;
+        size_t len;
+    };
+
+//编译期拼接状态行和Connection字段
+#define HEADER_TEMPLATE(code, title, conn) "HTTP/1.1 " #code " " title "\r\nConnection:" conn "\r\n"
+//字符串字面量转换为Bytes，长度在编译期确定
+#define HEADER_BYTES(str) {str, sizeof(str) - 1}
+
+    //默认的Content-Type字段
+    constexpr Bytes kHtmlType = HEADER_BYTES("Content-Type:text/html\r\n");
+    constexpr Bytes kContentLength = HEADER_BYTES("Content-Length:");
+    constexpr Bytes kHeaderEnd = HEADER_BYTES("\r\n\r\n");
+    constexpr Bytes kNoHeader = HEADER_BYTES("");
+
+    //压缩版本的Content-Encoding字段，下标是FileCache.h中的ENCODING；同一个url按Accept-Encoding返回不同内容，缓存需要Vary
+    constexpr Bytes kContentEncoding[] = {
+        HEADER_BYTES(""),
+        HEADER_BYTES("Content-Encoding:gzip\r\nVary:Accept-Encoding\r\n"),
+        HEADER_BYTES("Content-Encoding:br\r\nVary:Accept-Encoding\r\n")};
+    //可压缩的文件以原文发送时也要带上Vary
+    constexpr Bytes kVary = HEADER_BYTES("Vary:Accept-Encoding\r\n");
+
+    //Content-Length数字的最大长度（long的位数+符号位+'\0'）
+    const size_t kMaxDigits = 21;
+
+    //根据状态码和是否keep-alive返回状态行模板，未知状态码按500处理
+    inline const Bytes &status_line(int status, bool linger)
+    {
+        //[状态][0:close 1:keep-alive]
+        static constexpr Bytes lines[][2] = {
+            {HEADER_BYTES(HEADER_TEMPLATE(200, "OK", "close")), HEADER_BYTES(HEADER_TEMPLATE(200, "OK", "keep-alive"))},
+            {HEADER_BYTES(HEADER_TEMPLATE(400, "Bad Request", "close")), HEADER_BYTES(HEADER_TEMPLATE(400, "Bad Request", "keep-alive"))},
+            {HEADER_BYTES(HEADER_TEMPLATE(403, "Forbidden", "close")), HEADER_BYTES(HEADER_TEMPLATE(403, "Forbidden", "keep-alive"))},
+            {HEADER_BYTES(HEADER_TEMPLATE(404, "Not Found", "close")), HEADER_BYTES(HEADER_TEMPLATE(404, "Not Found", "keep-alive"))},
+            {HEADER_BYTES(HEADER_TEMPLATE(500, "Internal Error", "close")), HEADER_BYTES(HEADER_TEMPLATE(500, "Internal Error", "keep-alive"))},
+            //503带上Retry-After，告诉客户端稍后重试
+            {HEADER_BYTES(HEADER_TEMPLATE(503, "Service Unavailable", "close") "Retry-After:1\r\n"),
+             HEADER_BYTES(HEADER_TEMPLATE(503, "Service Unavailable", "keep-alive") "Retry-After:1\r\n")},
+            {HEADER_BYTES(HEADER_TEMPLATE(304, "Not Modified", "close")), HEADER_BYTES(HEADER_TEMPLATE(304, "Not Modified", "keep-alive"))}};
+        switch (status)
+        {
+        case 200:
+            return lines[0][linger];
+        case 400:
+            return lines[1][linger];
+        case 403:
+            return lines[2][linger];
+        case 404:
+            return lines[3][linger];
+        case 503:
+            return lines[5][linger];
+        case 304:
+            return lines[6][linger];
+        default:
+            return lines[4][linger];
+        }
+    }
+
+    //将完整的响应头（含结尾空行）写入buf，extra是Content-Length之前的其他字段，返回写入的字节数；空间不足时返回-1
+    inline int build(char *buf, size_t cap, int status, bool linger, long content_length,
+                     const Bytes &content_type = kHtmlType, const Bytes &extra = kNoHeader)
+    {
+        const Bytes &line = status_line(status, linger);
+        if (line.len + content_type.len + extra.len + kContentLength.len + kMaxDigits + kHeaderEnd.len > cap)
+        {
+            return -1;
+        }
+        char *p = buf;
+        memcpy(p, line.data, line.len);
+        p += line.len;
+        memcpy(p, content_type.data, content_type.len);
+        p += content_type.len;
+        memcpy(p, extra.data, extra.len);
+        p += extra.len;
+        memcpy(p, kContentLength.data, kContentLength.len);
+        p += kContentLength.len;
+        p += clog::detail::convert(p, content_length);
+        memcpy(p, kHeaderEnd.data, kHeaderEnd.len);
+        p += kHeaderEnd.len;
+        return p - buf;
+    }
+
+    //完整的304响应：状态行、fields和结尾空行，没有响应体，也不带Content-Length；空间不足时返回-1
+    inline int build_not_modified(char *buf, size_t cap, bool linger, const Bytes &fields)
+    {
+        const Bytes &line = status_line(304, linger);
+        if (line.len + fields.len + 2 > cap)
+        {
+            return -1;
+        }
+        char *p = buf;
+        memcpy(p, line.data, line.len);
+        p += line.len;
+        memcpy(p, fields.data, fields.len);
+        p += fields.len;
+        memcpy(p, "\r\n", 2);
+        p += 2;
+        return p - buf;
+    }
+
+    //错误响应的响应体
+    constexpr Bytes kBody400 = HEADER_BYTES("Your request has bad syntax or is inherently impossible to staisfy.\n");
+    constexpr Bytes kBody403 = HEADER_BYTES("You do not have permission to get file form this server.\n");
+    constexpr Bytes kBody404 = HEADER_BYTES("The requested file was not found on this server.\n");
+    constexpr Bytes kBody500 = HEADER_BYTES("There was an unusual problem serving the request file.\n");
+    constexpr Bytes kBody503 = HEADER_BYTES("The server is busy, please retry later.\n");
+    //健康检查的响应体
+    constexpr Bytes kBody200 = HEADER_BYTES("ok\n");
+
+    //预先序列化的完整错误响应（状态行+响应头+响应体），以及健康检查的200响应
+    //启动时生成一次，之后所有连接只读共享，发送时直接把m_iv[0]指向这里，不用拷贝到写缓冲区
+    class CannedResponses
+    {
+    public:
+        static const CannedResponses &instance()
+        {
+            static CannedResponses mInstance;
+            return mInstance;
+        }
+
+        //获取status对应的响应，未知状态码按500处理
+        Bytes get(int status, bool linger) const
+        {
+            const Canned &c = m_canned[index(status)][linger];
+            return {c.data, c.len};
+        }
+
+    private:
+        CannedResponses()
+        {
+            const int status[] = {400, 403, 404, 503, 500, 200};
+            const Bytes *body[] = {&kBody400, &kBody403, &kBody404, &kBody503, &kBody500, &kBody200};
+            for (int i = 0; i < CANNED_NUM; i++)
+            {
+                for (int linger = 0; linger < 2; linger++)
+                {
+                    Canned &c = m_canned[i][linger];
+                    int len = build(c.data, CANNED_SIZE, status[i], linger, body[i]->len);
+                    memcpy(c.data + len, body[i]->data, body[i]->len);
+                    c.len = len + body[i]->len;
+                }
+            }
+        }
+
+        static int index(int status)
+        {
+            switch (status)
+            {
+            case 400:
+                return 0;
+            case 403:
+                return 1;
+            case 404:
+                return 2;
+            case 503:
+                return 3;
+            case 200:
+                return 5;
+            default:
+                return 4;
+            }
+        }
+
+    private:
+        static const int CANNED_NUM = 6;
+        static const int CANNED_SIZE = 512;
+        struct Canned
+        {
+            char data[CANNED_SIZE];
+            size_t len;
+        };
+        Canned m_canned[CANNED_NUM][2]; //[状态][0:close 1:keep-alive]
+    };
+
+} // end of namespace header
+
+#endif // HTTPHEADER_H
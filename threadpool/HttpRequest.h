@@ -8,16 +8,16 @@
 #define HTTPREQUEST_H
 #include <string>
 #include <map>
+#include <memory>
 #include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/mman.h>
 #include "HttpServer.h"
-#include "../lock/locker.h"
+#include "Router.h"
+#include "FileCache.h"
 #include "../log/AsyncLogger.h"
 #include "../log/Logger.h"
-extern std::map<std::string, std::string> users; //保存post请求体
-extern locker m_userslock;                       //保护users临界资源
 
 class HttpRequest
 {
@@ -40,16 +40,23 @@ public:
     /*服务器处理HTTP请求的返回结果*/
     enum HTTP_CODE
     {
-        NO_REQUEST = 0,    //没有请求
-        GET_REQUEST,       //获得请求
-        BAD_REQUEST,       //错误请求
-        NO_RESOURCE,       //没有资源
-        FORBIDDEN_REQUEST, //禁止请求
-        FILE_REQUEST,      //html资源文件请求
-        INTERNAL_ERROR,    //服务器错误
-        CLOSED_CONNECTION  //关闭连接
+        NO_REQUEST = 0,     //没有请求
+        GET_REQUEST,        //获得请求
+        BAD_REQUEST,        //错误请求
+        NO_RESOURCE,        //没有资源
+        FORBIDDEN_REQUEST,  //禁止请求
+        FILE_REQUEST,       //html资源文件请求
+        INTERNAL_ERROR,     //服务器错误
+        CLOSED_CONNECTION,  //关闭连接
+        PENDING_REQUEST,    //请求已挂起，等待其他线程池完成后恢复
+        SERVICE_UNAVAILABLE, //服务繁忙
+        CANNED_REQUEST,     //动态路由选择了预先生成的响应，例如健康检查
+        NOT_MODIFIED        //条件请求验证通过，返回304
     };
 
+    //挂起请求时在其他线程池中执行的任务，返回要发送的文件
+    typedef const StaticFile *(*DeferredFunc)(HttpRequest *req);
+
     /*行的读取状态*/
     enum LINE_STATUS
     {
@@ -70,6 +77,22 @@ public:
         m_read_idx = 0;
         m_checked_idx = 0;
         m_start_line = 0;
+        m_content_length = 0;
+        m_linger = false;
+        cgi = 0;
+        m_file_address = nullptr;
+        m_entry.reset();
+        m_body = nullptr;
+        m_body_len = 0;
+        m_encoding = ENCODING_IDENTITY;
+        m_content_type = &header::kHtmlType;
+        m_fields = header::kNoHeader;
+        m_accept_encoding = 0;
+        m_if_none_match = nullptr;
+        m_if_modified_since = -1;
+        m_not_modified = header::kNoHeader;
+        m_deferred = nullptr;
+        m_canned = 0;
         memset(m_read_buf, '\0', READ_BUFFER_SIZE);
         memset(m_real_file, '\0', FILENAME_LEN);
     }
@@ -81,6 +104,21 @@ public:
     //解析HTTP请求
     HTTP_CODE process_request();
 
+    //执行挂起时登记的任务，并打开它选择的文件，由HttpServer::resume()在其他线程池中调用
+    HTTP_CODE run_deferred();
+
+    //协程模式下由连接自己读取数据：返回读缓冲区的剩余空间，读到数据后调用commit()
+    char *read_space(int &len)
+    {
+        len = READ_BUFFER_SIZE - m_read_idx;
+        return m_read_buf + m_read_idx;
+    }
+    void commit(int len) { m_read_idx += len; }
+
+    //主线程在交给线程池之前调用：只查看已经读到的请求行，按路由得到请求类别，不修改读缓冲区
+    //请求行还没有读完整时返回-1
+    int classify() const;
+
 public:
     //设置cfd
     void set_cfd(int cfd) { m_cfd = cfd; }
@@ -90,8 +128,32 @@ public:
 
     struct stat get_file_stat() { return m_file_stat; }
 
+    //要发送的响应体：缓存中的某个版本，或者mmap映射的文件
+    const char *get_body() const { return m_body; }
+    long get_body_len() const { return m_body_len; }
+    //响应体的编码，见FileCache.h中的ENCODING
+    int get_encoding() const { return m_encoding; }
+    //响应体的Content-Type字段，以及之后的Cache-Control、ETag等字段
+    const header::Bytes &get_content_type() const { return *m_content_type; }
+    const header::Bytes &get_fields() const { return m_fields; }
+    //完整的304响应：缓存条目中预先生成的，或者在m_fields_buf中生成的
+    const header::Bytes &get_not_modified() const { return m_not_modified; }
+
     bool get_linger() { return m_linger; }
 
+    //获得POST请求体
+    const char *get_content() { return m_string; }
+
+    //动态路由选择要返回的文件
+    void set_target(const StaticFile *file) { m_target = file->path.c_str(); }
+
+    //动态路由挂起请求：耗时的任务（例如口令哈希）交给其他线程池执行，完成后再生成响应
+    void defer(DeferredFunc func) { m_deferred = func; }
+
+    //动态路由直接返回预先生成的响应，不读取文件
+    void set_canned(int status) { m_canned = status; }
+    int get_canned() const { return m_canned; }
+
 private:
     //检查是否是完整的行：'\r\n'
     LINE_STATUS check_line();
@@ -105,19 +167,33 @@ private:
     /*当得到一个完整、正确的HTTP请求时，我们就分析目标文件的属性。
 如果目标文件存在、对所有用户可读，且不是目录，则使用mmap将其映射到内存地址m_file_address处，并告诉调用者获取文件成功*/
     HTTP_CODE do_request();
+    //检查m_target的属性，优先使用文件缓存，不在缓存中的大文件映射到内存中
+    HTTP_CODE open_target();
+    //按Accept-Encoding选择缓存中的版本
+    void select_encoding();
+    //规范化url的路径部分写入out：合并重复的'/'，去掉"."段；含有".."段或者out放不下时返回false
+    static bool normalize_path(const char *url, char *out, size_t cap);
+    //Accept-Encoding字段解析为以ENCODING为位的掩码，q=0的编码不接受
+    static int parse_accept_encoding(const char *text);
+    //GET请求的If-None-Match或If-Modified-Since验证通过：客户端的副本仍然有效
+    bool not_modified(const char *etag, size_t len, time_t mtime) const;
+    //If-None-Match中的某个实体标签和etag弱比较相等，或者是"*"
+    static bool etag_match(const char *list, const char *etag, size_t len);
+    //解析IMF-fixdate格式的HTTP日期，其他格式返回-1
+    static time_t parse_http_date(const char *text);
     //获取一行数据
     char *get_line() { return m_read_buf + m_start_line; }
 
 private:
     static const int FILENAME_LEN = 200;
-    static const int READ_BUFFER_SIZE = 2048;                  //读缓冲区的大小
-    const char *doc_root = "/home/zhl/桌面/MyHttpServer/html"; //网站根路径
-    int m_cfd;                                                 //连接cfd
-    CHECK_STATE m_state;                                       //初始状态
-    char m_read_buf[READ_BUFFER_SIZE];                         //存放http request的读缓冲区
-    int m_read_idx;                                            //标识读缓冲中已经读入的客户数据的最后一个字节的下一个位置
-    int m_checked_idx;                                         //当前正在分析的字符在读缓冲区中的位置
-    int m_start_line;                                          //当前正在解析的行的起始位置
+    static const int FIELDS_LEN = 384; //不在缓存中的文件的响应头字段或者304响应
+    static const int READ_BUFFER_SIZE = 2048; //读缓冲区的大小
+    int m_cfd;                                //连接cfd
+    CHECK_STATE m_state;                      //初始状态
+    char m_read_buf[READ_BUFFER_SIZE];        //存放http request的读缓冲区
+    int m_read_idx;                           //标识读缓冲中已经读入的客户数据的最后一个字节的下一个位置
+    int m_checked_idx;                        //当前正在分析的字符在读缓冲区中的位置
+    int m_start_line;                         //当前正在解析的行的起始位置
 
     METHOD m_method; //请求方法
     char *m_url;     //请求url
@@ -129,10 +205,25 @@ private:
     char *m_host;         //请求头Host
     char *m_string;       //存储请求头数据
 
-    char m_real_file[FILENAME_LEN]; //HTML资源文件名
+    char m_real_file[FILENAME_LEN]; //没有注册路由时，网站根目录下的资源文件名
+    const char *m_target;           //要返回的资源文件的绝对路径
+    DeferredFunc m_deferred;        //挂起请求时登记的任务
+    int m_canned;                   //动态路由选择的预先生成的响应的状态码，0表示没有
     struct stat m_file_stat;        //文件属性
 
     char *m_file_address; //html资源文件的内存地址
+
+    int m_accept_encoding;               //请求头Accept-Encoding
+    std::shared_ptr<CacheEntry> m_entry; //缓存中的文件，发送期间保持引用
+    const char *m_body;                  //响应体
+    long m_body_len;                     //响应体长度
+    int m_encoding;                      //响应体的编码
+    const header::Bytes *m_content_type; //按扩展名得到的Content-Type字段
+    header::Bytes m_fields;              //缓存条目中预先生成的字段，或者指向m_fields_buf
+    char m_fields_buf[FIELDS_LEN];
+    const char *m_if_none_match;         //请求头If-None-Match，指向读缓冲区
+    time_t m_if_modified_since;          //请求头If-Modified-Since，-1表示没有
+    header::Bytes m_not_modified;        //304响应
 };
 
 bool HttpRequest::read()
@@ -145,12 +236,15 @@ bool HttpRequest::read()
     int bytes_read = 0;
     //接收读取到的字符，读缓冲区逐渐缩小
     bytes_read = recv(m_cfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
-    m_read_idx += bytes_read;
-
+    if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        return true;
+    }
     if (bytes_read <= 0)
     {
         return false;
     }
+    m_read_idx += bytes_read;
     return true;
 }
 
@@ -289,13 +383,6 @@ HttpRequest::HTTP_CODE HttpRequest::parse_requestline(char *text)
     }
     if (!m_url || m_url[0] != '/')
         return BAD_REQUEST;
-    //当url为/时，返回判断界面
-    if (strlen(m_url) == 1)
-    {
-        //把"index.html"所指向的字符串追加到m_url所指向的字符串的结尾
-        //printf("return judge.html\n");
-        strcat(m_url, "judge.html");
-    }
     //推动状态机：解析请求头
     m_state = CHECK_STATE_HEADER;
     return NO_REQUEST;
@@ -335,6 +422,24 @@ HttpRequest::HTTP_CODE HttpRequest::parse_headers(char *text)
         text += strspn(text, " \t");
         m_content_length = atol(text);
     }
+    //处理Accept-Encoding头部字段
+    else if (strncasecmp(text, "Accept-Encoding:", 16) == 0)
+    {
+        m_accept_encoding = parse_accept_encoding(text + 16);
+    }
+    //条件请求的验证字段
+    else if (strncasecmp(text, "If-None-Match:", 14) == 0)
+    {
+        text += 14;
+        text += strspn(text, " \t");
+        m_if_none_match = text;
+    }
+    else if (strncasecmp(text, "If-Modified-Since:", 18) == 0)
+    {
+        text += 18;
+        text += strspn(text, " \t");
+        m_if_modified_since = parse_http_date(text);
+    }
     //处理Host头部字段
     else if (strncasecmp(text, "Host:", 5) == 0)
     {
@@ -369,121 +474,293 @@ HttpRequest::HTTP_CODE HttpRequest::do_request()
 {
     //std::cout << "do_request()" << std::endl;
     //LOG_TRACE << "do_queset()";
-    strcpy(m_real_file, doc_root);
-    int len = strlen(doc_root);
-    //printf("m_url:%s\n", m_url);
-    /*
-    post    -> html
-    "/0"   返回注册页面    register.html
-    "/1"   返回登录页面    log.html
-    "/2"   登录，返回欢迎页面 welcome.html
-    "/3"   注册，返回登录页面    log.html
-    "/4"   返回图片资源    picture.html
-    "/5"   返回视频资源    video.html
-    */
-    //在m_url中搜索最后一次出现字符 c（一个无符号字符）的位置，返回最后一个c之后的子串
-    const char *p = strrchr(m_url, '/');
-    //处理POST请求（注册、登录请求）
-    if (cgi == 1 && (*(p + 1) == '2' || *(p + 1) == '3'))
-    {
-        char flag = m_url[1]; //0表示注册、1表示登录
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/");
-        strcat(m_url_real, m_url + 2);
-        strncpy(m_real_file + len, m_url_real, FILENAME_LEN - len - 1);
-        free(m_url_real);
-
-        //m_string保存了post发送的用户名和密码，使用'&'进行连接
-        //user=123&passwd=123
-        char name[100], password[100];
-        int i;
-        for (i = 5; m_string[i] != '&'; ++i)
-            name[i - 5] = m_string[i];
-        name[i - 5] = '\0';
-
-        int j = 0;
-        for (i = i + 10; m_string[i] != '\0'; ++i, ++j)
-            password[j] = m_string[i];
-        password[j] = '\0';
-        //printf("user=%s\tpassword=%s\n", name, password);
-        LOG_WARN << "user = " << name << "\tpassword = " << password;
-        //登录验证
-        if (*(p + 1) == '2')
+    //路由在启动时注册，见main.cpp中的init_routes()
+    RouteMatch match;
+    const Route *route = Router::instance().match(m_method, m_url, match);
+    m_target = nullptr;
+    if (route && route->handler)
+    {
+        if (!route->handler(this, match))
+            return BAD_REQUEST;
+        if (m_deferred)
+            return PENDING_REQUEST;
+        if (m_canned)
+            return CANNED_REQUEST;
+    }
+    else if (route)
+    {
+        m_target = route->file->path.c_str();
+    }
+
+    //没有注册的路由：返回网站根目录下的同名文件
+    if (!m_target)
+    {
+        int len = Router::instance().doc_root_len();
+        strcpy(m_real_file, Router::instance().doc_root());
+        //同一个文件只有一种写法，也是文件缓存的键；含有".."的url不能访问网站根目录之外的文件
+        if (!normalize_path(m_url, m_real_file + len, FILENAME_LEN - len))
+            return FORBIDDEN_REQUEST;
+        m_target = m_real_file;
+    }
+    return open_target();
+}
+
+int HttpRequest::classify() const
+{
+    const char *eol = (const char *)memchr(m_read_buf, '\n', m_read_idx);
+    if (!eol)
+        return -1;
+    int method;
+    const char *p;
+    if (strncasecmp(m_read_buf, "GET ", 4) == 0)
+    {
+        method = GET;
+        p = m_read_buf + 4;
+    }
+    else if (strncasecmp(m_read_buf, "POST ", 5) == 0)
+    {
+        method = POST;
+        p = m_read_buf + 5;
+    }
+    else
+        return CLASS_DYNAMIC;
+    p += strspn(p, " \t");
+    //Router::match()需要以'\0'结尾的url，复制到栈上
+    char url[256];
+    size_t len = strcspn(p, " \t\r\n");
+    if (len == 0 || len >= sizeof(url) || p + len > eol)
+        return CLASS_DYNAMIC;
+    memcpy(url, p, len);
+    url[len] = '\0';
+    return Router::instance().classify(method, url);
+}
+
+HttpRequest::HTTP_CODE HttpRequest::run_deferred()
+{
+    const StaticFile *file = m_deferred(this);
+    m_deferred = nullptr;
+    if (!file)
+        return INTERNAL_ERROR;
+    set_target(file);
+    return open_target();
+}
+
+HttpRequest::HTTP_CODE HttpRequest::open_target()
+{
+    //缓存命中时不访问文件系统
+    FileCache &cache = FileCache::instance();
+    m_entry = cache.lookup(m_target);
+    if (!m_entry)
+    {
+        if (stat(m_target, &m_file_stat) < 0)
+            return NO_RESOURCE;
+        if (!(m_file_stat.st_mode & S_IROTH))
+            return FORBIDDEN_REQUEST;
+        if (S_ISDIR(m_file_stat.st_mode))
+            return BAD_REQUEST;
+        m_entry = cache.fill(m_target, m_file_stat);
+    }
+    if (m_entry)
+    {
+        m_file_stat = m_entry->st;
+        select_encoding();
+        //客户端的副本仍然有效：发送条目中预先生成的304响应
+        const std::string &etag = m_entry->etag[m_encoding];
+        if (not_modified(etag.data(), etag.size(), m_file_stat.st_mtime))
         {
-            //若浏览器端输入的用户名和密码在表中可以查找到，返回欢迎页面
-            if (users.find(name) != users.end() && users[name] == password)
-            {
-                //printf("return welcome.html\n");
-                strcpy(m_url, "/welcome.html");
-            }
-            else
-                strcpy(m_url, "/logError.html");
+            const std::string &head = m_entry->not_modified[m_encoding][m_linger];
+            m_not_modified = {head.data(), head.size()};
+            return NOT_MODIFIED;
         }
-        //注册：线程安全，当多个用户同时注册，且用户名相同时，需要互斥
-        else if (*(p + 1) == '3')
+        return FILE_REQUEST;
+    }
+
+    //不在缓存中的文件在打开之前验证，304响应不需要映射文件
+    char etag[64];
+    int etag_len = FileCache::format_etag(etag, sizeof(etag), m_file_stat, ENCODING_IDENTITY);
+    if (etag_len > 0 && not_modified(etag, etag_len, m_file_stat.st_mtime))
+    {
+        char fields[FIELDS_LEN];
+        int len = cache.format_fields(fields, sizeof(fields), m_file_stat, ENCODING_IDENTITY, false, true);
+        len = header::build_not_modified(m_fields_buf, FIELDS_LEN, m_linger, {fields, (size_t)(len > 0 ? len : 0)});
+        if (len > 0)
         {
-            //如果不存在这条新数据，则插入
-            if (users.find(name) == users.end())
-            {
-                m_userslock.lock();
-                users[name] = password;
-                m_userslock.unlock();
-                //printf("return log.html\n");
-                strcpy(m_url, "/log.html");
-            }
-            else
-                strcpy(m_url, "/registerError.html");
+            m_not_modified = {m_fields_buf, (size_t)len};
+            return NOT_MODIFIED;
         }
     }
 
-    //get请求
-    if (*(p + 1) == '0')
+    //太大或者缓存已满：mmap将硬盘上的html资源映射到内存中
+    //stat之后文件可能已经被删除或者替换：打不开时按不存在处理，映射的长度以打开的文件为准
+    int fd = open(m_target, O_RDONLY);
+    if (fd < 0)
+        return NO_RESOURCE;
+    if (fstat(fd, &m_file_stat) < 0)
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        //printf("return register.html\n");
-        strcpy(m_url_real, "/register.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-        free(m_url_real);
+        close(fd);
+        return INTERNAL_ERROR;
     }
-    else if (*(p + 1) == '1')
+    //所在的内存地址为m_file_address，之后response；空文件不能映射，只发送响应头
+    if (m_file_stat.st_size > 0)
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        //printf("return log.html\n");
-        strcpy(m_url_real, "/log.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-        free(m_url_real);
+        void *addr = mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED)
+        {
+            close(fd);
+            return INTERNAL_ERROR;
+        }
+        m_file_address = (char *)addr;
     }
-    else if (*(p + 1) == '4')
+    close(fd);
+    m_body = m_file_address;
+    m_body_len = m_file_stat.st_size;
+    m_content_type = &mime::lookup(m_target).field;
+    int len = cache.format_fields(m_fields_buf, FIELDS_LEN, m_file_stat, ENCODING_IDENTITY, false);
+    m_fields = {m_fields_buf, (size_t)(len > 0 ? len : 0)};
+    return FILE_REQUEST;
+}
+
+void HttpRequest::select_encoding()
+{
+    //brotli比gzip小，两种都接受时优先brotli
+    static const int preferred[] = {ENCODING_BR, ENCODING_GZIP};
+    m_encoding = ENCODING_IDENTITY;
+    for (int enc : preferred)
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        //printf("return picture.html\n");
-        strcpy(m_url_real, "/picture.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-        free(m_url_real);
+        if ((m_accept_encoding & (1 << enc)) && m_entry->ready[enc].load(std::memory_order_acquire))
+        {
+            m_encoding = enc;
+            break;
+        }
     }
-    else if (*(p + 1) == '5')
+    const std::string &body = m_entry->body[m_encoding];
+    m_body = body.data();
+    m_body_len = body.size();
+    m_content_type = &m_entry->type->field;
+    const std::string &fields = m_entry->fields[m_encoding];
+    m_fields = {fields.data(), fields.size()};
+}
+
+bool HttpRequest::normalize_path(const char *url, char *out, size_t cap)
+{
+    size_t n = 0;
+    while (*url)
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        //printf("return video.html\n");
-        strcpy(m_url_real, "/video.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-        free(m_url_real);
+        url += strspn(url, "/");
+        size_t len = strcspn(url, "/");
+        if (len == 0)
+            break;
+        if (len == 1 && url[0] == '.')
+        {
+            url += len;
+            continue;
+        }
+        if (len == 2 && url[0] == '.' && url[1] == '.')
+            return false;
+        //'/'、路径段和结尾的'\0'
+        if (n + 1 + len + 1 > cap)
+            return false;
+        out[n++] = '/';
+        memcpy(out + n, url, len);
+        n += len;
+        url += len;
     }
-    else
-        strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
-    if (stat(m_real_file, &m_file_stat) < 0)
-        return NO_RESOURCE;
-    if (!(m_file_stat.st_mode & S_IROTH))
-        return FORBIDDEN_REQUEST;
-    if (S_ISDIR(m_file_stat.st_mode))
-        return BAD_REQUEST;
+    if (n == 0)
+    {
+        if (cap < 2)
+            return false;
+        out[n++] = '/';
+    }
+    out[n] = '\0';
+    return true;
+}
 
-    //mmap将硬盘上的html资源映射到内存中
-    int fd = open(m_real_file, O_RDONLY);
-    //所在的内存地址为m_file_address，之后response
-    m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    close(fd);
-    return FILE_REQUEST;
+bool HttpRequest::not_modified(const char *etag, size_t len, time_t mtime) const
+{
+    if (m_method != GET)
+        return false;
+    //同时带有两个字段时只看If-None-Match
+    if (m_if_none_match)
+        return etag_match(m_if_none_match, etag, len);
+    return m_if_modified_since != -1 && mtime <= m_if_modified_since;
+}
+
+bool HttpRequest::etag_match(const char *list, const char *etag, size_t len)
+{
+    while (*list)
+    {
+        list += strspn(list, " \t,");
+        if (*list == '*')
+            return true;
+        //弱比较：忽略W/前缀
+        if (strncmp(list, "W/", 2) == 0)
+            list += 2;
+        if (*list != '"')
+            return false;
+        const char *end = strchr(list + 1, '"');
+        if (!end)
+            return false;
+        if ((size_t)(end + 1 - list) == len && memcmp(list, etag, len) == 0)
+            return true;
+        list = end + 1;
+    }
+    return false;
+}
+
+time_t HttpRequest::parse_http_date(const char *text)
+{
+    //Sun, 06 Nov 1994 08:49:37 GMT
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    const char *comma = strchr(text, ',');
+    if (!comma)
+        return -1;
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    char mon[4];
+    if (sscanf(comma + 1, " %2d %3s %4d %2d:%2d:%2d GMT", &tm.tm_mday, mon, &tm.tm_year, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6)
+        return -1;
+    const char *m = strstr(months, mon);
+    if (!m || (m - months) % 3 != 0)
+        return -1;
+    tm.tm_mon = (m - months) / 3;
+    tm.tm_year -= 1900;
+    return timegm(&tm);
+}
+
+int HttpRequest::parse_accept_encoding(const char *text)
+{
+    //显式列出的编码以自己的q值为准，"*"匹配其他所有编码
+    int accept = 0, named = 0;
+    bool any = false;
+    while (*text)
+    {
+        text += strspn(text, " \t,");
+        const char *end = text + strcspn(text, ",");
+        size_t len = strcspn(text, " \t,;");
+        bool zero = false;
+        for (const char *p = text + len; p + 1 < end; p++)
+        {
+            if ((p[0] == 'q' || p[0] == 'Q') && p[1] == '=')
+            {
+                zero = strtod(p + 2, nullptr) == 0;
+                break;
+            }
+        }
+        int bits = 0;
+        if ((len == 4 && strncasecmp(text, "gzip", 4) == 0) || (len == 6 && strncasecmp(text, "x-gzip", 6) == 0))
+            bits = 1 << ENCODING_GZIP;
+        else if (len == 2 && strncasecmp(text, "br", 2) == 0)
+            bits = 1 << ENCODING_BR;
+        else if (len == 1 && text[0] == '*')
+            any = !zero;
+        named |= bits;
+        if (!zero)
+            accept |= bits;
+        text = end;
+    }
+    if (any)
+        accept |= ~named & (((1 << ENCODING_NUM) - 1) & ~(1 << ENCODING_IDENTITY));
+    return accept;
 }
 
 #endif // HTTPREQUEST_H
\ No newline at end of file
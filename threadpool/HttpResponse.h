@@ -10,24 +10,11 @@
 #include <sys/uio.h>
 #include <map>
 #include <string>
-#include <stdarg.h>
 #include "../utils/utils.h"
 #include "HttpRequest.h"
+#include "HttpHeader.h"
 #include "../log/AsyncLogger.h"
 #include "../log/Logger.h"
-std::map<const int, const char *> RES_CODE = {
-    {200, "OK"},
-    {400, "Bad Request"},
-    {403, "Forbidden"},
-    {404, "Not Found"},
-    {500, "Internal Error"}};
-std::map<const int, const char *> RES_SOURCE =
-    {
-        {400, "Your request has bad syntax or is inherently impossible to staisfy.\n"},
-        {403, "You do not have permission to get file form this server.\n"},
-        {404, "The requested file was not found on this server.\n"},
-        {500, "There was an unusual problem serving the request file.\n"}};
-
 class HttpResponse
 {
 public:
@@ -58,44 +45,49 @@ public:
     //设置epfd
     void set_epfd(int epollfd) { epfd = epollfd; }
 
+    //没有等待发送的数据：响应已经发送完毕，或者还没有生成响应
+    bool sent_all() const { return bytes_to_send <= 0; }
+
+    //process_write()生成的IO向量，协程模式下由连接自己发送
+    struct iovec *iov(int &count)
+    {
+        count = m_iv_count;
+        return m_iv;
+    }
+
+    //响应发送完毕或者放弃发送：解除文件映射，keep-alive时重置请求，返回是否保持连接
+    bool finish();
+
 private:
     //解除html文件的内存地址映射
     void unmap();
 
-    //设置response
-    bool set_response(const char *format, ...);
-
     //设置响应主体
     bool set_content(const char *content);
 
-    //设置状态
-    bool set_status_line(int status);
-
-    //设置响应头
-    bool set_headers(int content_length);
-
-    //设置content-type
-    bool set_content_type();
+    //发送预先生成的错误响应，不拷贝到写缓冲区
+    bool set_canned(int status);
 
-    //设置content-length
-    bool set_content_length(int content_length);
+    //发送完整的预先生成的响应，m_iv[0]直接指向bytes
+    bool set_preformatted(const header::Bytes &bytes);
 
-    //设置keepalive
-    bool set_linger();
-
-    //设置空行
-    bool set_blank_line();
+    //设置状态行和响应头：使用HttpHeader.h中预先格式化的模板
+    bool set_headers(int status, long content_length, const header::Bytes &content_type = header::kHtmlType,
+                     const header::Bytes &extra = header::kNoHeader);
 
 private:
     int epfd;   //HttpServer.h传来的epfd
 
     static const int WRITE_BUFFER_SIZE = 1024;
+    static const int WRITE_QUANTUM = 256 * 1024; //一次write()最多发送的字节数，剩下的等下一轮EPOLLOUT
     char m_write_buf[WRITE_BUFFER_SIZE]; //发送缓冲区
     int m_write_idx;                     //发送的下一个字节
 
-    int bytes_to_send;   //待发送的数据长度
-    int bytes_have_send; //已经发送的数据长度
-    int m_cfd;           //连接cfd
+    const char *m_head;   //第一个IO向量的起始地址：m_write_buf或预先生成的错误响应
+    int m_head_len;       //第一个IO向量的总长度
+    long bytes_to_send;   //待发送的数据长度，文件可能超过2GB
+    long bytes_have_send; //已经发送的数据长度
+    int m_cfd;            //连接cfd
 
     struct iovec m_iv[2]; //IO向量数组，iovec.iov_base存放readv/writev缓冲区数据，iovec.iov_len记录数据长度
     int m_iv_count;
@@ -125,8 +117,15 @@ bool HttpResponse::write()
     }
 
     //发送数据
+    int sent = 0;
     while (1)
     {
+        //大文件分多轮发送，避免一个连接占住主线程；重新注册EPOLLOUT后socket可写时会再次触发
+        if (sent >= WRITE_QUANTUM)
+        {
+            modfd(epfd, m_cfd, EPOLLOUT);
+            return true;
+        }
         temp = writev(m_cfd, m_iv, m_iv_count);
         if (temp < 0)
         {
@@ -140,111 +139,86 @@ bool HttpResponse::write()
         }
 
         //更新待发送和已发送字节数
+        sent += temp;
         bytes_have_send += temp;
         bytes_to_send -= temp;
         //已发送字节数<第一个缓冲区的长度
-        if (bytes_have_send < m_iv[0].iov_len)
+        if (bytes_have_send < m_head_len)
         {
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - bytes_have_send;
+            m_iv[0].iov_base = (char *)m_head + bytes_have_send;
+            m_iv[0].iov_len = m_head_len - bytes_have_send;
         }
         //否则使用第二个IO向量缓冲区
-        else
+        else if (m_iv_count == 2)
         {
             m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = request.get_file_address() + (bytes_have_send - m_write_idx);
+            m_iv[1].iov_base = (char *)request.get_body() + (bytes_have_send - m_head_len);
             m_iv[1].iov_len = bytes_to_send;
         }
         //无数据可发送，则监听EPOLLIN事件，初始化request数据
         if (bytes_to_send <= 0)
         {
-            unmap();
             modfd(epfd, m_cfd, EPOLLIN);
-            if (request.get_linger())
-            {
-                init();
-                return true;
-            }
-            else
-            {
-                return false;
-            }
+            return finish();
         }
     }
 }
+bool HttpResponse::finish()
+{
+    unmap();
+    //关闭连接时也重置，避免连接对象保留已经解除映射的文件地址
+    bool linger = request.get_linger();
+    init();
+    return linger;
+}
+
 bool HttpResponse::process_write(HttpRequest::HTTP_CODE ret)
 {
     switch (ret)
     {
+    //错误响应直接使用预先生成的字节
     case HttpRequest::HTTP_CODE::INTERNAL_ERROR:
-    {
-        set_status_line(500);
-        set_headers(strlen(RES_SOURCE[500]));
-        if (!set_content(RES_SOURCE[500]))
-        {
-            return false;
-        }
-        break;
-    }
+        return set_canned(500);
     case HttpRequest::HTTP_CODE::BAD_REQUEST:
-    {
-        set_status_line(400);
-        set_headers(strlen(RES_SOURCE[400]));
-        if (!set_content(RES_SOURCE[400]))
-        {
-            return false;
-        }
-        break;
-    }
+        return set_canned(400);
     case HttpRequest::HTTP_CODE::NO_RESOURCE:
-    {
-        set_status_line(404);
-        set_headers(strlen(RES_SOURCE[404]));
-        if (!set_content(RES_SOURCE[404]))
-        {
-            return false;
-        }
-        break;
-    }
+        return set_canned(404);
     case HttpRequest::HTTP_CODE::FORBIDDEN_REQUEST:
-    {
-        set_status_line(403);
-        set_headers(strlen(RES_SOURCE[403]));
-        if (!set_content(RES_SOURCE[403]))
-        {
-            return false;
-        }
-        break;
-    }
+        return set_canned(403);
+    case HttpRequest::HTTP_CODE::SERVICE_UNAVAILABLE:
+        return set_canned(503);
+    case HttpRequest::HTTP_CODE::CANNED_REQUEST:
+        return set_canned(request.get_canned());
+    //304响应由文件缓存预先生成，一次写完
+    case HttpRequest::HTTP_CODE::NOT_MODIFIED:
+        return set_preformatted(request.get_not_modified());
     case HttpRequest::HTTP_CODE::FILE_REQUEST:
     {
-        set_status_line(200);
-        if (request.get_file_stat().st_size != 0)
-        {
-            set_headers(request.get_file_stat().st_size);
-            //第一个缓冲区：当前写缓冲区
-            m_iv[0].iov_base = m_write_buf;
-            m_iv[0].iov_len = m_write_idx;
-            //第二个缓冲区:html内容
-            m_iv[1].iov_base = request.get_file_address();
-            m_iv[1].iov_len = request.get_file_stat().st_size;
-            m_iv_count = 2;
-            //总的待发送字节数=当前写缓冲区的内容长度+html内容长度
-            bytes_to_send = m_write_idx + request.get_file_stat().st_size;
-            return true;
-        }
-        else
-        {
-            const char *ok_string = "<html><body></body></html>";
-            set_headers(strlen(ok_string));
-            if (!set_content(ok_string))
-                return false;
-        }
+        //Content-Type和缓存相关的字段由文件缓存预先生成
+        if (!set_headers(200, request.get_body_len(), request.get_content_type(), request.get_fields()))
+            return false;
+        //空文件只发送响应头
+        if (request.get_body_len() == 0)
+            break;
+        //第一个缓冲区：当前写缓冲区
+        m_head = m_write_buf;
+        m_head_len = m_write_idx;
+        m_iv[0].iov_base = m_write_buf;
+        m_iv[0].iov_len = m_write_idx;
+        //第二个缓冲区:html内容，缓存中的某个版本或者mmap映射的文件
+        m_iv[1].iov_base = (char *)request.get_body();
+        m_iv[1].iov_len = request.get_body_len();
+        m_iv_count = 2;
+        //总的待发送字节数=当前写缓冲区的内容长度+html内容长度
+        bytes_to_send = m_write_idx + request.get_body_len();
+        return true;
     }
     default:
         return false;
     }
-    //除了FILE_REQUEST外的其他情况
+    //只有响应头的情况，包括空文件
+    m_head = m_write_buf;
+    m_head_len = m_write_idx;
     m_iv[0].iov_base = m_write_buf;
     m_iv[0].iov_len = m_write_idx;
     m_iv_count = 1;
@@ -252,58 +226,41 @@ bool HttpResponse::process_write(HttpRequest::HTTP_CODE ret)
     return true;
 }
 
-bool HttpResponse::set_response(const char *format, ...)
+bool HttpResponse::set_content(const char *content)
 {
-    if (m_write_idx >= WRITE_BUFFER_SIZE)
+    int len = strlen(content);
+    if (len >= WRITE_BUFFER_SIZE - m_write_idx)
         return false;
-    va_list arg_list;
-    va_start(arg_list, format);
-    int len = vsnprintf(m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list);
-    if (len >= (WRITE_BUFFER_SIZE - 1 - m_write_idx))
-    {
-        va_end(arg_list);
-        return false;
-    }
+    memcpy(m_write_buf + m_write_idx, content, len);
     m_write_idx += len;
-    va_end(arg_list);
     return true;
 }
 
-bool HttpResponse::set_content(const char *content)
-{
-    return set_response("%s", content);
-}
-
-bool HttpResponse::set_status_line(int status)
-{
-    return set_response("%s %d %s\r\n", "HTTP/1.1", status, RES_CODE[status]);
-}
-
-bool HttpResponse::set_headers(int content_length)
-{
-    set_content_type();
-    set_content_length(content_length);
-    set_linger();
-    set_blank_line();
-}
-
-bool HttpResponse::set_content_type()
+bool HttpResponse::set_canned(int status)
 {
-    return set_response("Content-Type:%s\r\n", "text/html");
+    return set_preformatted(header::CannedResponses::instance().get(status, request.get_linger()));
 }
 
-bool HttpResponse::set_content_length(int content_length)
+bool HttpResponse::set_preformatted(const header::Bytes &bytes)
 {
-    return set_response("Content-Length:%d\r\n", content_length);
-}
-
-bool HttpResponse::set_linger()
-{
-    return set_response("Connection:%s\r\n", (request.get_linger() == true) ? "keep-alive" : "close");
+    if (bytes.len == 0)
+        return false;
+    m_head = bytes.data;
+    m_head_len = bytes.len;
+    m_iv[0].iov_base = (char *)bytes.data;
+    m_iv[0].iov_len = bytes.len;
+    m_iv_count = 1;
+    bytes_to_send = bytes.len;
+    return true;
 }
 
-bool HttpResponse::set_blank_line()
+bool HttpResponse::set_headers(int status, long content_length, const header::Bytes &content_type, const header::Bytes &extra)
 {
-    return set_response("%s", "\r\n");
+    int len = header::build(m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - m_write_idx,
+                            status, request.get_linger(), content_length, content_type, extra);
+    if (len < 0)
+        return false;
+    m_write_idx += len;
+    return true;
 }
 #endif // HTTPRESPONSE_H
\ No newline at end of file
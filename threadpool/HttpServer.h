@@ -23,16 +23,38 @@
 #include <errno.h>
 #include <sys/uio.h>
 #include <iostream>
+#include <atomic>
 #include "HttpRequest.h"
 #include "HttpResponse.h"
+#include "threadpool.h"
+#include "Coroutine.h"
 #include "../utils/utils.h"
 #include "../log/AsyncLogger.h"
 #include "../log/Logger.h"
 
+class HttpServer;
+
+//挂起的请求：交给crypto线程池执行，完成后恢复连接
+struct DeferredTask
+{
+    HttpServer *conn;
+    void process();
+    void shed();
+};
+
+//请求计数：started = completed + aborted + rejected + 正在处理的请求，退出时用来确认没有丢失请求
+struct RequestStats
+{
+    std::atomic<uint64_t> started;   //交给线程池的请求
+    std::atomic<uint64_t> completed; //响应发送完毕
+    std::atomic<uint64_t> aborted;   //响应发送完之前连接被关闭
+    std::atomic<uint64_t> rejected;  //线程池队列已满或者过载，返回503后关闭
+};
+
 class HttpServer
 {
 public:
-    HttpServer() {}
+    HttpServer() : m_deferred(0), m_inflight(false), m_class(-1) {}
     ~HttpServer() {}
 
 public:
@@ -50,9 +72,37 @@ public:
     //IO处理函数：解析http requset，响应http response
     void process();
 
+    //恢复挂起的请求：在crypto线程池中执行挂起的任务，然后生成响应
+    void resume();
+
+    //线程池过载，请求排队太久：不再处理，直接返回预先生成的503
+    void shed();
+
     //关闭连接
     void close_conn(bool real_close = true);
 
+    //主线程把读到的请求交给线程池之前调用，请求读完之前的多次调用只计一次
+    void start_request();
+
+    //请求在线程池中的类别(Router.h中的REQUEST_CLASS)，由主线程在append()之前调用
+    //请求行读完整后确定，之后分多次读到的请求体保持同一个类别；请求行还不完整时按动态请求处理
+    int request_class();
+
+    //线程池拒绝了请求：发送预先生成的503(带Retry-After)后关闭连接，计入rejected
+    void reject();
+
+    //正在处理、还没有发送完响应的请求数
+    static uint64_t in_flight();
+
+    //请求计数，SIGUSR1和退出时输出
+    static std::string report();
+
+#ifdef HAVE_COROUTINE
+    //协程模式：连接的整个生命周期是一个协程，读请求、生成响应、发送响应按顺序写在一个函数中，不经过HTTP线程池
+    //主线程accept之后调用，连接关闭时协程结束
+    coro::Task serve(coro::Scheduler &sched);
+#endif
+
 public:
     /*线程池模型中，所有socket上的事件都被注册到同一个epoll内核事件表中，所以将epoll文件描述符设置为静态的，
     在main线程中进行初始化*/
@@ -60,7 +110,16 @@ public:
     /*进程池模型中，worker进程监听的socket被注册到不同的epoll内核事件表中，
     调用void init(int epfd, int cfd, struct sockadd_in &addr)初始化*/
     int _epfd;
-    static int m_user_count; //统计用户数量
+    static std::atomic<int> m_user_count; //统计用户数量：主线程accept时增加，close_conn()在线程池中也会减少
+    uint32_t m_deferred;     //主线程推迟到下一轮处理的事件，只由主线程访问
+    static RequestStats m_stats;
+
+private:
+    //生成http response，并监听EPOLLOUT
+    void respond(HttpRequest::HTTP_CODE ret);
+
+    //请求结束：响应发送完毕，或者连接被关闭
+    void finish_request(bool completed);
 
 private:
     int m_sockfd;              //用于通信的连接cfd
@@ -68,19 +127,53 @@ private:
 
     HttpRequest *httpRequest;
     HttpResponse httpResponse;
+    DeferredTask m_task; //挂起请求时交给crypto线程池的任务
+    //已经计入started、还没有结束的请求；EPOLLONESHOT保证同一时刻只有一个线程访问
+    bool m_inflight;
+    int m_class; //当前请求的类别，-1表示还没有读到完整的请求行
+
+#ifdef HAVE_COROUTINE
+    //挂起请求：交给crypto线程池，resume()完成后把协程交还给主线程；队列已满时不挂起，直接返回503
+    struct DeferAwaiter
+    {
+        HttpServer *conn;
+        bool await_ready() { return false; }
+        bool await_suspend(std::coroutine_handle<> h);
+        HttpRequest::HTTP_CODE await_resume() { return conn->m_deferred_ret; }
+    };
+
+    coro::Scheduler *m_sched = nullptr; //协程模式下的调度器，为空表示线程池模式
+    std::coroutine_handle<> m_waiter;   //等待crypto线程池的协程
+    HttpRequest::HTTP_CODE m_deferred_ret; //crypto线程池中执行的结果
+#endif
 
     char *file_address; //html资源文件的内存地址
 };
 
+void DeferredTask::process()
+{
+    conn->resume();
+}
+
+void DeferredTask::shed()
+{
+    conn->shed();
+}
+
 int HttpServer::m_epollfd = -1;
-int HttpServer::m_user_count = 0;
+std::atomic<int> HttpServer::m_user_count(0);
+RequestStats HttpServer::m_stats;
 
 void HttpServer::init(int cfd, struct sockaddr_in &addr)
 {
     m_user_count++;
     m_sockfd = cfd;
     m_addr = addr;
+    m_class = -1;
+    //cfd由accept4(SOCK_NONBLOCK)创建，响应由主线程发送，阻塞的writev会让一个慢客户卡住整个事件循环
     addfd(m_epollfd, m_sockfd, true);
+    //同一个fd上之前的连接可能在请求中途被关闭，清空残留的请求状态
+    httpResponse.init();
     //获取request对象
     httpRequest = httpResponse.get_request();
     httpRequest->set_cfd(cfd);
@@ -96,7 +189,70 @@ bool HttpServer::read()
 
 bool HttpServer::write()
 {
-    return httpResponse.write();
+    bool ret = httpResponse.write();
+    if (httpResponse.sent_all())
+    {
+        finish_request(true);
+    }
+    return ret;
+}
+
+void HttpServer::start_request()
+{
+    if (!m_inflight)
+    {
+        m_inflight = true;
+        m_stats.started++;
+    }
+}
+
+int HttpServer::request_class()
+{
+    if (m_class < 0)
+    {
+        m_class = httpRequest->classify();
+    }
+    return m_class < 0 ? CLASS_DYNAMIC : m_class;
+}
+
+void HttpServer::finish_request(bool completed)
+{
+    m_class = -1;
+    if (m_inflight)
+    {
+        m_inflight = false;
+        (completed ? m_stats.completed : m_stats.aborted)++;
+    }
+}
+
+void HttpServer::reject()
+{
+    m_class = -1;
+    if (m_inflight)
+    {
+        m_inflight = false;
+        m_stats.rejected++;
+    }
+    //响应很短，直接在主线程中非阻塞发送，发送不完整也不重试
+    header::Bytes resp = header::CannedResponses::instance().get(503, false);
+    send(m_sockfd, resp.data, resp.len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    close_conn();
+}
+
+uint64_t HttpServer::in_flight()
+{
+    //先读结束的计数，结果只会偏大
+    uint64_t finished = m_stats.completed + m_stats.aborted + m_stats.rejected;
+    return m_stats.started - finished;
+}
+
+std::string HttpServer::report()
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf), "requests: started=%llu completed=%llu aborted=%llu rejected=%llu in_flight=%llu",
+             (unsigned long long)m_stats.started, (unsigned long long)m_stats.completed, (unsigned long long)m_stats.aborted,
+             (unsigned long long)m_stats.rejected, (unsigned long long)in_flight());
+    return buf;
 }
 void HttpServer::close_conn(bool real_close)
 {
@@ -107,6 +263,7 @@ void HttpServer::close_conn(bool real_close)
         delfd(m_epollfd, m_sockfd);
         m_sockfd = -1;
         m_user_count--;
+        finish_request(false);
     }
 }
 
@@ -119,13 +276,111 @@ void HttpServer::process()
         modfd(m_epollfd, m_sockfd, EPOLLIN);
         return;
     }
+    //请求被挂起：交给crypto线程池，完成后由resume()生成响应，期间连接上不会有新的事件(EPOLLONESHOT)
+    if (read_ret == HttpRequest::PENDING_REQUEST)
+    {
+        m_task.conn = this;
+        if (ThreadPool<DeferredTask>::create().append(&m_task))
+        {
+            return;
+        }
+        //crypto线程池的队列已满，直接拒绝，不影响静态文件的处理
+        LOG_WARN << "crypto queue is full, reject client fd=" << m_sockfd;
+        read_ret = HttpRequest::SERVICE_UNAVAILABLE;
+    }
+    respond(read_ret);
+}
+
+void HttpServer::resume()
+{
+#ifdef HAVE_COROUTINE
+    if (m_sched)
+    {
+        m_deferred_ret = httpRequest->run_deferred();
+        m_sched->post(m_waiter);
+        return;
+    }
+#endif
+    respond(httpRequest->run_deferred());
+}
+
+void HttpServer::shed()
+{
+#ifdef HAVE_COROUTINE
+    if (m_sched)
+    {
+        m_deferred_ret = HttpRequest::SERVICE_UNAVAILABLE;
+        m_sched->post(m_waiter);
+        return;
+    }
+#endif
+    respond(HttpRequest::SERVICE_UNAVAILABLE);
+}
+
+void HttpServer::respond(HttpRequest::HTTP_CODE ret)
+{
     //reponse响应
-    bool write_ret = httpResponse.process_write(read_ret);
+    bool write_ret = httpResponse.process_write(ret);
     if (!write_ret)
     {
+        //可能在线程池中执行：关闭之后fd随时会被主线程accept复用，不能再修改它的事件
         close_conn();
+        return;
     }
     modfd(m_epollfd, m_sockfd, EPOLLOUT);
 }
 
+#ifdef HAVE_COROUTINE
+bool HttpServer::DeferAwaiter::await_suspend(std::coroutine_handle<> h)
+{
+    conn->m_waiter = h;
+    conn->m_task.conn = conn;
+    if (ThreadPool<DeferredTask>::create().append(&conn->m_task))
+    {
+        return true;
+    }
+    LOG_WARN << "crypto queue is full, reject client fd=" << conn->m_sockfd;
+    conn->m_deferred_ret = HttpRequest::SERVICE_UNAVAILABLE;
+    return false;
+}
+
+coro::Task HttpServer::serve(coro::Scheduler &sched)
+{
+    m_sched = &sched;
+    coro::Conn conn(sched, m_sockfd);
+    bool keep = true;
+    while (keep)
+    {
+        int space;
+        char *buf = httpRequest->read_space(space);
+        //请求超出读缓冲区
+        if (space <= 0)
+            break;
+        ssize_t n = co_await conn.read_some(buf, space);
+        if (n <= 0)
+            break;
+        //排空期间keep-alive连接上的新请求不再处理，已经读了一部分的请求继续处理完
+        if (sched.stopping() && !m_inflight)
+            break;
+        httpRequest->commit(n);
+        start_request();
+        HttpRequest::HTTP_CODE ret = httpRequest->process_request();
+        if (ret == HttpRequest::NO_REQUEST)
+            continue;
+        if (ret == HttpRequest::PENDING_REQUEST)
+            ret = co_await DeferAwaiter{this};
+        if (!httpResponse.process_write(ret))
+            break;
+        int iovcnt;
+        struct iovec *iov = httpResponse.iov(iovcnt);
+        bool sent = co_await conn.write_all(iov, iovcnt);
+        keep = httpResponse.finish() && sent;
+        if (sent)
+            finish_request(true);
+    }
+    close_conn();
+    m_sched = nullptr;
+}
+#endif
+
 #endif // HTTPSERVER_H
\ No newline at end of file
@@ -0,0 +1,137 @@
+/**
+ * @author: fenghaze
+ * @date: 2026/10/20 01:30
+ * @desc: 文件扩展名到Content-Type的映射
+ * 扩展名表在编译期构造成完美哈希：每个扩展名落在不同的槽里，static_assert保证没有冲突，
+ * 查找时只计算一次哈希、比较一次字符串；结果保存在文件缓存的条目中，缓存命中的请求不再查找
+ * 增加扩展名后如果static_assert失败，修改kSeed或者加大kSlots
+ */
+
+#ifndef MIMETYPES_H
+#define MIMETYPES_H
+
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include "HttpHeader.h"
+
+namespace mime
+{
+    struct Type
+    {
+        const char *ext;       //小写的扩展名，不含'.'
+        header::Bytes field;   //完整的Content-Type字段
+        bool compressible;     //文本类的类型才值得压缩
+    };
+
+#define MIME_TYPE(ext, type, compressible) {ext, HEADER_BYTES("Content-Type:" type "\r\n"), compressible}
+
+    constexpr Type kTypes[] = {
+        MIME_TYPE("html", "text/html; charset=utf-8", true),
+        MIME_TYPE("htm", "text/html; charset=utf-8", true),
+        MIME_TYPE("css", "text/css; charset=utf-8", true),
+        MIME_TYPE("js", "text/javascript; charset=utf-8", true),
+        MIME_TYPE("mjs", "text/javascript; charset=utf-8", true),
+        MIME_TYPE("json", "application/json", true),
+        MIME_TYPE("map", "application/json", true),
+        MIME_TYPE("txt", "text/plain; charset=utf-8", true),
+        MIME_TYPE("md", "text/markdown; charset=utf-8", true),
+        MIME_TYPE("csv", "text/csv; charset=utf-8", true),
+        MIME_TYPE("xml", "application/xml", true),
+        MIME_TYPE("svg", "image/svg+xml", true),
+        MIME_TYPE("ico", "image/x-icon", true),
+        MIME_TYPE("png", "image/png", false),
+        MIME_TYPE("jpg", "image/jpeg", false),
+        MIME_TYPE("jpeg", "image/jpeg", false),
+        MIME_TYPE("gif", "image/gif", false),
+        MIME_TYPE("webp", "image/webp", false),
+        MIME_TYPE("avif", "image/avif", false),
+        MIME_TYPE("bmp", "image/bmp", true),
+        MIME_TYPE("mp4", "video/mp4", false),
+        MIME_TYPE("webm", "video/webm", false),
+        MIME_TYPE("ogg", "audio/ogg", false),
+        MIME_TYPE("mp3", "audio/mpeg", false),
+        MIME_TYPE("wav", "audio/wav", false),
+        MIME_TYPE("pdf", "application/pdf", false),
+        MIME_TYPE("wasm", "application/wasm", true),
+        MIME_TYPE("woff", "font/woff", false),
+        MIME_TYPE("woff2", "font/woff2", false),
+        MIME_TYPE("ttf", "font/ttf", true),
+        MIME_TYPE("zip", "application/zip", false),
+        MIME_TYPE("gz", "application/gzip", false),
+    };
+
+    //未知的扩展名：浏览器按下载处理，不会把内容当成html执行
+    constexpr Type kDefault = MIME_TYPE("", "application/octet-stream", false);
+
+#undef MIME_TYPE
+
+    constexpr int kNumTypes = sizeof(kTypes) / sizeof(kTypes[0]);
+    constexpr uint32_t kSeed = 2166145011u; //FNV的偏移量附近第一个没有冲突的种子
+    constexpr int kSlots = 64;      //2的幂
+    constexpr size_t kMaxExt = 8;   //更长的扩展名不在表中
+
+    constexpr char lower(char c) { return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c; }
+
+    //FNV-1a，忽略大小写
+    constexpr uint32_t hash(const char *s, size_t len)
+    {
+        uint32_t h = kSeed;
+        for (size_t i = 0; i < len; i++)
+        {
+            h ^= (unsigned char)lower(s[i]);
+            h *= 16777619u;
+        }
+        return (h ^ (h >> 15)) & (kSlots - 1);
+    }
+
+    constexpr size_t length(const char *s) { return *s ? 1 + length(s + 1) : 0; }
+
+    //槽 → kTypes的下标，-1表示空槽
+    struct Table
+    {
+        int8_t slot[kSlots];
+    };
+
+    constexpr Table build_table()
+    {
+        Table t{};
+        for (int i = 0; i < kSlots; i++)
+            t.slot[i] = -1;
+        for (int i = 0; i < kNumTypes; i++)
+            t.slot[hash(kTypes[i].ext, length(kTypes[i].ext))] = i;
+        return t;
+    }
+
+    constexpr Table kTable = build_table();
+
+    //每个扩展名都留在自己的槽里，说明没有冲突
+    constexpr bool perfect()
+    {
+        for (int i = 0; i < kNumTypes; i++)
+        {
+            if (kTable.slot[hash(kTypes[i].ext, length(kTypes[i].ext))] != i)
+                return false;
+        }
+        return true;
+    }
+    static_assert(perfect(), "mime table has a collision, change kSeed or kSlots");
+
+    //按路径的扩展名查找类型，没有扩展名或者不在表中时返回kDefault
+    inline const Type &lookup(const char *path)
+    {
+        const char *dot = strrchr(path, '.');
+        if (!dot || strchr(dot, '/'))
+            return kDefault;
+        const char *ext = dot + 1;
+        size_t len = strlen(ext);
+        if (len == 0 || len > kMaxExt)
+            return kDefault;
+        int idx = kTable.slot[hash(ext, len)];
+        if (idx < 0 || strlen(kTypes[idx].ext) != len || strncasecmp(kTypes[idx].ext, ext, len) != 0)
+            return kDefault;
+        return kTypes[idx];
+    }
+} // namespace mime
+
+#endif // MIMETYPES_H
@@ -0,0 +1,291 @@
+/**
+ * @author: fenghaze
+ * @date: 2026/10/19 14:20
+ * @desc: 加盐的口令哈希：PBKDF2-HMAC-SHA256
+ * 存储格式为 "pbkdf2$迭代次数$盐(hex)$哈希(hex)"
+ * 每次计算都需要毫秒级的CPU时间，不能在处理静态文件的线程池中执行，见main.cpp中的crypto线程池
+ */
+
+#ifndef PASSWORD_H
+#define PASSWORD_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string>
+
+namespace password
+{
+    const int SALT_LEN = 16;      //盐的字节数
+    const int HASH_LEN = 32;      //SHA256摘要的字节数
+    const int ITERATIONS = 10000; //PBKDF2迭代次数
+
+    class Sha256
+    {
+    public:
+        Sha256() { reset(); }
+
+        void reset()
+        {
+            static const uint32_t init[8] = {
+                0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+            memcpy(m_state, init, sizeof(m_state));
+            m_len = 0;
+            m_buf_len = 0;
+        }
+
+        void update(const uint8_t *data, size_t len)
+        {
+            m_len += len;
+            while (len > 0)
+            {
+                size_t n = 64 - m_buf_len < len ? 64 - m_buf_len : len;
+                memcpy(m_buf + m_buf_len, data, n);
+                m_buf_len += n;
+                data += n;
+                len -= n;
+                if (m_buf_len == 64)
+                {
+                    transform(m_buf);
+                    m_buf_len = 0;
+                }
+            }
+        }
+
+        void final(uint8_t out[HASH_LEN])
+        {
+            uint64_t bits = m_len * 8;
+            uint8_t pad = 0x80;
+            update(&pad, 1);
+            pad = 0;
+            while (m_buf_len != 56)
+            {
+                update(&pad, 1);
+            }
+            uint8_t len[8];
+            for (int i = 0; i < 8; i++)
+            {
+                len[i] = bits >> (56 - 8 * i);
+            }
+            update(len, 8);
+            for (int i = 0; i < 8; i++)
+            {
+                out[4 * i] = m_state[i] >> 24;
+                out[4 * i + 1] = m_state[i] >> 16;
+                out[4 * i + 2] = m_state[i] >> 8;
+                out[4 * i + 3] = m_state[i];
+            }
+        }
+
+    private:
+        static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+        void transform(const uint8_t block[64])
+        {
+            static const uint32_t k[64] = {
+                0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+                0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+                0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+                0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+                0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+                0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+                0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+                0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+            uint32_t w[64];
+            for (int i = 0; i < 16; i++)
+            {
+                w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 |
+                       (uint32_t)block[4 * i + 2] << 8 | (uint32_t)block[4 * i + 3];
+            }
+            for (int i = 16; i < 64; i++)
+            {
+                uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+                uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+                w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+            }
+            uint32_t a = m_state[0], b = m_state[1], c = m_state[2], d = m_state[3];
+            uint32_t e = m_state[4], f = m_state[5], g = m_state[6], h = m_state[7];
+            for (int i = 0; i < 64; i++)
+            {
+                uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+                uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+                h = g;
+                g = f;
+                f = e;
+                e = d + t1;
+                d = c;
+                c = b;
+                b = a;
+                a = t1 + t2;
+            }
+            m_state[0] += a;
+            m_state[1] += b;
+            m_state[2] += c;
+            m_state[3] += d;
+            m_state[4] += e;
+            m_state[5] += f;
+            m_state[6] += g;
+            m_state[7] += h;
+        }
+
+    private:
+        uint32_t m_state[8];
+        uint64_t m_len;
+        uint8_t m_buf[64];
+        size_t m_buf_len;
+    };
+
+    //HMAC-SHA256：内外两层的初始状态只计算一次，PBKDF2的每轮迭代直接复制
+    class HmacSha256
+    {
+    public:
+        HmacSha256(const uint8_t *key, size_t len)
+        {
+            uint8_t k[64] = {0};
+            if (len > 64)
+            {
+                Sha256 h;
+                h.update(key, len);
+                h.final(k);
+            }
+            else
+            {
+                memcpy(k, key, len);
+            }
+            uint8_t pad[64];
+            for (int i = 0; i < 64; i++)
+            {
+                pad[i] = k[i] ^ 0x36;
+            }
+            m_inner.update(pad, 64);
+            for (int i = 0; i < 64; i++)
+            {
+                pad[i] = k[i] ^ 0x5c;
+            }
+            m_outer.update(pad, 64);
+        }
+
+        void mac(const uint8_t *data, size_t len, uint8_t out[HASH_LEN]) const
+        {
+            Sha256 inner = m_inner;
+            inner.update(data, len);
+            inner.final(out);
+            Sha256 outer = m_outer;
+            outer.update(out, HASH_LEN);
+            outer.final(out);
+        }
+
+    private:
+        Sha256 m_inner;
+        Sha256 m_outer;
+    };
+
+    //PBKDF2-HMAC-SHA256，只输出一个块（32字节）
+    inline void pbkdf2(const std::string &pass, const uint8_t *salt, size_t salt_len, int iterations, uint8_t out[HASH_LEN])
+    {
+        HmacSha256 hmac((const uint8_t *)pass.data(), pass.size());
+        uint8_t block[SALT_LEN + 4];
+        memcpy(block, salt, salt_len);
+        block[salt_len] = 0;
+        block[salt_len + 1] = 0;
+        block[salt_len + 2] = 0;
+        block[salt_len + 3] = 1;
+        uint8_t u[HASH_LEN];
+        hmac.mac(block, salt_len + 4, u);
+        memcpy(out, u, HASH_LEN);
+        for (int i = 1; i < iterations; i++)
+        {
+            hmac.mac(u, HASH_LEN, u);
+            for (int j = 0; j < HASH_LEN; j++)
+            {
+                out[j] ^= u[j];
+            }
+        }
+    }
+
+    inline std::string to_hex(const uint8_t *data, size_t len)
+    {
+        static const char hex[] = "0123456789abcdef";
+        std::string s(len * 2, '0');
+        for (size_t i = 0; i < len; i++)
+        {
+            s[2 * i] = hex[data[i] >> 4];
+            s[2 * i + 1] = hex[data[i] & 0xf];
+        }
+        return s;
+    }
+
+    inline bool from_hex(const char *s, size_t len, uint8_t *out)
+    {
+        for (size_t i = 0; i < len; i++)
+        {
+            int v = 0;
+            for (int j = 0; j < 2; j++)
+            {
+                char c = s[2 * i + j];
+                v <<= 4;
+                if (c >= '0' && c <= '9')
+                    v |= c - '0';
+                else if (c >= 'a' && c <= 'f')
+                    v |= c - 'a' + 10;
+                else
+                    return false;
+            }
+            out[i] = v;
+        }
+        return true;
+    }
+
+    //生成加盐哈希，返回存储格式的字符串
+    inline std::string hash(const std::string &pass, int iterations = ITERATIONS)
+    {
+        uint8_t salt[SALT_LEN];
+        int fd = open("/dev/urandom", O_RDONLY);
+        if (fd < 0 || read(fd, salt, SALT_LEN) != SALT_LEN)
+        {
+            //没有/dev/urandom时退化为伪随机数，依然保证每个用户的盐不同
+            for (int i = 0; i < SALT_LEN; i++)
+            {
+                salt[i] = rand();
+            }
+        }
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        uint8_t out[HASH_LEN];
+        pbkdf2(pass, salt, SALT_LEN, iterations, out);
+        return "pbkdf2$" + std::to_string(iterations) + "$" + to_hex(salt, SALT_LEN) + "$" + to_hex(out, HASH_LEN);
+    }
+
+    //校验口令，比较时不提前返回，避免泄露匹配的长度
+    inline bool verify(const std::string &pass, const std::string &stored)
+    {
+        int iterations = 0;
+        char salt_hex[2 * SALT_LEN + 1], hash_hex[2 * HASH_LEN + 1];
+        if (sscanf(stored.c_str(), "pbkdf2$%d$%32[0-9a-f]$%64[0-9a-f]", &iterations, salt_hex, hash_hex) != 3 ||
+            iterations <= 0 || strlen(salt_hex) != 2 * SALT_LEN || strlen(hash_hex) != 2 * HASH_LEN)
+        {
+            return false;
+        }
+        uint8_t salt[SALT_LEN], expect[HASH_LEN], out[HASH_LEN];
+        if (!from_hex(salt_hex, SALT_LEN, salt) || !from_hex(hash_hex, HASH_LEN, expect))
+        {
+            return false;
+        }
+        pbkdf2(pass, salt, SALT_LEN, iterations, out);
+        uint8_t diff = 0;
+        for (int i = 0; i < HASH_LEN; i++)
+        {
+            diff |= out[i] ^ expect[i];
+        }
+        return diff == 0;
+    }
+
+} // end of namespace password
+
+#endif // PASSWORD_H
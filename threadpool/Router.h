@@ -0,0 +1,289 @@
+/**
+ * @author: fenghaze
+ * @date: 2026/10/19 11:20
+ * @desc: 路由表
+ * 启动时注册路由，按路径段组织成前缀树；查找时只在请求url上移动指针，不分配内存
+ * 路由模式支持三种路径段：
+ *  "/log"        普通段，完全匹配
+ *  "/user/:id"   参数段，匹配任意一段，捕获到RouteMatch中
+ *  "/2*"        前缀段，匹配以前缀开头的剩余路径，捕获剩余部分；前缀也可以是整段，例如"/s/"后接'*'
+ * 每个路由对应一个静态文件或一个动态回调
+ * 每个路由还带有一个请求类别，主线程读到请求行后用classify()查出类别，线程池按类别调度
+ */
+
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <string.h>
+#include <assert.h>
+#include <string>
+#include <vector>
+#include <memory>
+
+class HttpRequest;
+
+//静态文件：注册时拼接好绝对路径，请求时直接使用
+struct StaticFile
+{
+    std::string path;
+};
+
+//一次匹配的结果：参数段和前缀段捕获的子串直接指向请求url
+struct RouteMatch
+{
+    static const int MAX_PARAMS = 4;
+    struct Param
+    {
+        const char *data;
+        int len;
+    };
+    Param params[MAX_PARAMS];
+    int param_count;
+};
+
+//动态路由回调：通过req->set_target()选择要返回的文件，返回false表示错误请求
+typedef bool (*RouteHandler)(HttpRequest *req, const RouteMatch &match);
+
+//请求类别：线程池中每个类别有自己的队列、权重和并发上限
+enum REQUEST_CLASS
+{
+    CLASS_HEALTH = 0,  //健康检查
+    CLASS_STATIC_HIT,  //注册过的静态文件，绝对路径已经拼接好
+    CLASS_STATIC_MISS, //没有注册的路径，需要在网站根目录下查找
+    CLASS_DYNAMIC,     //动态路由，以及请求行还不完整的请求
+    CLASS_NUM
+};
+
+struct Route
+{
+    const StaticFile *file; //静态文件路由
+    RouteHandler handler;   //动态路由
+    int cls;                //请求类别，REQUEST_CLASS
+};
+
+class Router
+{
+public:
+    //注册路由时使用的方法掩码，第i位对应HttpRequest::METHOD中的第i个方法
+    enum METHOD_MASK
+    {
+        GET = 1 << 0,
+        POST = 1 << 1,
+        ANY = GET | POST
+    };
+
+    static Router &instance()
+    {
+        static Router mInstance;
+        return mInstance;
+    }
+
+    //设置网站根目录，必须在注册文件之前调用
+    void set_doc_root(const char *root)
+    {
+        m_doc_root = root;
+    }
+    const char *doc_root() const { return m_doc_root.c_str(); }
+    int doc_root_len() const { return m_doc_root.size(); }
+
+    //获得网站根目录下的静态文件，绝对路径只拼接一次
+    const StaticFile *file(const char *rel)
+    {
+        assert(!m_doc_root.empty());
+        for (auto &f : m_files)
+        {
+            if (f->path.compare(m_doc_root.size(), std::string::npos, rel) == 0)
+            {
+                return f.get();
+            }
+        }
+        m_files.emplace_back(new StaticFile{m_doc_root + rel});
+        return m_files.back().get();
+    }
+
+    //注册过的所有静态文件，启动时预先加载到文件缓存
+    const std::vector<std::unique_ptr<StaticFile>> &files() const { return m_files; }
+
+    //注册静态文件路由
+    void add_file(int methods, const char *pattern, const char *rel)
+    {
+        add(methods, pattern, {file(rel), nullptr, CLASS_STATIC_HIT});
+    }
+
+    //注册动态路由
+    void add_handler(int methods, const char *pattern, RouteHandler handler, int cls = CLASS_DYNAMIC)
+    {
+        add(methods, pattern, {nullptr, handler, cls});
+    }
+
+    //请求的类别，没有匹配的路由时按网站根目录下的文件处理
+    int classify(int method, const char *url) const
+    {
+        RouteMatch m;
+        const Route *route = match(method, url, m);
+        return route ? route->cls : CLASS_STATIC_MISS;
+    }
+
+    static const char *class_name(int cls)
+    {
+        static const char *names[CLASS_NUM] = {"health", "static_hit", "static_miss", "dynamic"};
+        return cls >= 0 && cls < CLASS_NUM ? names[cls] : "unknown";
+    }
+
+    //查找路由，method为HttpRequest::METHOD，url在'\0'或'?'处结束；没有匹配的路由时返回nullptr
+    const Route *match(int method, const char *url, RouteMatch &m) const
+    {
+        const char *end = url + strcspn(url, "?");
+        m.param_count = 0;
+        if (method < 0 || method >= METHOD_NUM || *url != '/')
+        {
+            return nullptr;
+        }
+        //"/"没有路径段，对应根节点
+        if (end - url == 1)
+        {
+            return m_root.route(method);
+        }
+        return match(&m_root, method, url, end, m);
+    }
+
+private:
+    static const int METHOD_NUM = 2;
+
+    //前缀树节点：每个节点对应一个路径段
+    struct Node
+    {
+        Node()
+        {
+            memset(routes, 0, sizeof(routes));
+        }
+
+        const Route *route(int method) const
+        {
+            return (routes[method].file || routes[method].handler) ? &routes[method] : nullptr;
+        }
+
+        std::string seg;                            //普通段的内容，前缀段的前缀
+        std::vector<std::unique_ptr<Node>> children; //普通段
+        std::vector<std::unique_ptr<Node>> prefixes; //前缀段
+        std::unique_ptr<Node> param;                 //参数段
+        Route routes[METHOD_NUM];
+    };
+
+    Router() {}
+
+    void add(int methods, const char *pattern, const Route &route)
+    {
+        assert(pattern[0] == '/');
+        Node *node = &m_root;
+        const char *p = pattern + 1;
+        while (*p)
+        {
+            const char *next = strchr(p, '/');
+            std::string seg(p, next ? next - p : strlen(p));
+            if (!seg.empty() && seg.back() == '*')
+            {
+                //前缀段必须是模式的最后一段
+                assert(!next);
+                seg.pop_back();
+                node = child(node->prefixes, seg);
+                break;
+            }
+            else if (!seg.empty() && seg[0] == ':')
+            {
+                if (!node->param)
+                {
+                    node->param.reset(new Node);
+                }
+                node = node->param.get();
+            }
+            else
+            {
+                node = child(node->children, seg);
+            }
+            if (!next)
+            {
+                break;
+            }
+            p = next + 1;
+        }
+        for (int i = 0; i < METHOD_NUM; i++)
+        {
+            if (methods & (1 << i))
+            {
+                node->routes[i] = route;
+            }
+        }
+    }
+
+    static Node *child(std::vector<std::unique_ptr<Node>> &list, const std::string &seg)
+    {
+        for (auto &n : list)
+        {
+            if (n->seg == seg)
+            {
+                return n.get();
+            }
+        }
+        list.emplace_back(new Node);
+        list.back()->seg = seg;
+        return list.back().get();
+    }
+
+    //p指向当前路径段前的'/'，优先级：普通段 > 参数段 > 前缀段
+    static const Route *match(const Node *node, int method, const char *p, const char *end, RouteMatch &m)
+    {
+        if (p == end)
+        {
+            return node->route(method);
+        }
+        const char *seg = p + 1;
+        const char *next = seg;
+        while (next < end && *next != '/')
+        {
+            ++next;
+        }
+        size_t len = next - seg;
+        for (auto &c : node->children)
+        {
+            if (c->seg.size() == len && memcmp(c->seg.data(), seg, len) == 0)
+            {
+                const Route *r = match(c.get(), method, next, end, m);
+                if (r)
+                {
+                    return r;
+                }
+            }
+        }
+        if (node->param && m.param_count < RouteMatch::MAX_PARAMS)
+        {
+            m.params[m.param_count++] = {seg, (int)len};
+            const Route *r = match(node->param.get(), method, next, end, m);
+            if (r)
+            {
+                return r;
+            }
+            --m.param_count;
+        }
+        for (auto &c : node->prefixes)
+        {
+            const Route *r = c->route(method);
+            if (r && (size_t)(end - seg) >= c->seg.size() && memcmp(c->seg.data(), seg, c->seg.size()) == 0)
+            {
+                if (m.param_count < RouteMatch::MAX_PARAMS)
+                {
+                    m.params[m.param_count++] = {seg + c->seg.size(), (int)(end - seg - c->seg.size())};
+                }
+                return r;
+            }
+        }
+        return nullptr;
+    }
+
+private:
+    Node m_root;
+    std::string m_doc_root;
+    std::vector<std::unique_ptr<StaticFile>> m_files;
+};
+
+#endif // ROUTER_H
@@ -0,0 +1,213 @@
+/**
+ * @author: fenghaze
+ * @date: 2026/10/19 13:05
+ * @desc: 用户表：按用户名哈希分片，每个分片一把读写锁
+ * 登录只加读锁，不同分片的注册互不影响，同一分片的登录也不会被其他登录阻塞
+ * 可选的快照文件：退出时保存，启动时mmap整个文件并一次性解析，重启后用户表不丢失
+ */
+
+#ifndef USERSTORE_H
+#define USERSTORE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "../lock/locker.h"
+
+class UserStore
+{
+public:
+    static UserStore &instance()
+    {
+        static UserStore mInstance;
+        return mInstance;
+    }
+
+    //查找用户，存在时把对应的值拷贝到value中
+    bool find(const char *name, std::string &value);
+
+    //插入用户：检查和插入在同一把写锁内完成，用户已存在时返回false
+    bool insert(const char *name, const std::string &value);
+
+    //用户总数
+    size_t size();
+
+    //保存快照：先写临时文件再rename，保证快照文件总是完整的
+    bool save(const char *path);
+
+    //加载快照：文件不存在或格式不对时返回false
+    bool load(const char *path);
+
+private:
+    UserStore() {}
+
+    //FNV-1a哈希，选择分片
+    static uint32_t hash(const char *name)
+    {
+        uint32_t h = 2166136261u;
+        for (; *name; ++name)
+        {
+            h ^= (unsigned char)*name;
+            h *= 16777619u;
+        }
+        return h;
+    }
+
+private:
+    static const int SHARD_NUM = 64;          //分片数，2的幂
+    static const uint32_t MAGIC = 0x55535253; //快照文件头"USRS"
+
+    //每个分片独占一个cache line，避免不同分片的锁互相伪共享
+    struct alignas(64) Shard
+    {
+        rwlocker lock;
+        std::unordered_map<std::string, std::string> users;
+    };
+    Shard m_shards[SHARD_NUM];
+
+    //快照文件格式：头部 + count条记录，每条记录为 名字长度(u16) 值长度(u16) 名字 值
+    struct SnapshotHeader
+    {
+        uint32_t magic;
+        uint32_t count;
+    };
+};
+
+bool UserStore::find(const char *name, std::string &value)
+{
+    Shard &shard = m_shards[hash(name) & (SHARD_NUM - 1)];
+    shard.lock.rdlock();
+    auto it = shard.users.find(name);
+    bool found = it != shard.users.end();
+    if (found)
+    {
+        value = it->second;
+    }
+    shard.lock.unlock();
+    return found;
+}
+
+bool UserStore::insert(const char *name, const std::string &value)
+{
+    Shard &shard = m_shards[hash(name) & (SHARD_NUM - 1)];
+    shard.lock.wrlock();
+    bool inserted = shard.users.emplace(name, value).second;
+    shard.lock.unlock();
+    return inserted;
+}
+
+size_t UserStore::size()
+{
+    size_t n = 0;
+    for (int i = 0; i < SHARD_NUM; i++)
+    {
+        m_shards[i].lock.rdlock();
+        n += m_shards[i].users.size();
+        m_shards[i].lock.unlock();
+    }
+    return n;
+}
+
+bool UserStore::save(const char *path)
+{
+    std::vector<char> buf(sizeof(SnapshotHeader));
+    uint32_t count = 0;
+    for (int i = 0; i < SHARD_NUM; i++)
+    {
+        m_shards[i].lock.rdlock();
+        for (auto &user : m_shards[i].users)
+        {
+            if (user.first.size() > UINT16_MAX || user.second.size() > UINT16_MAX)
+            {
+                continue;
+            }
+            uint16_t len[2] = {(uint16_t)user.first.size(), (uint16_t)user.second.size()};
+            buf.insert(buf.end(), (char *)len, (char *)len + sizeof(len));
+            buf.insert(buf.end(), user.first.begin(), user.first.end());
+            buf.insert(buf.end(), user.second.begin(), user.second.end());
+            ++count;
+        }
+        m_shards[i].lock.unlock();
+    }
+    SnapshotHeader head = {MAGIC, count};
+    memcpy(buf.data(), &head, sizeof(head));
+
+    std::string tmp = std::string(path) + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+    {
+        return false;
+    }
+    size_t written = 0;
+    while (written < buf.size())
+    {
+        ssize_t n = write(fd, buf.data() + written, buf.size() - written);
+        if (n < 0)
+        {
+            close(fd);
+            unlink(tmp.c_str());
+            return false;
+        }
+        written += n;
+    }
+    fsync(fd);
+    close(fd);
+    return rename(tmp.c_str(), path) == 0;
+}
+
+bool UserStore::load(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(SnapshotHeader))
+    {
+        close(fd);
+        return false;
+    }
+    const char *data = (const char *)mmap(0, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return false;
+    }
+    SnapshotHeader head;
+    memcpy(&head, data, sizeof(head));
+    bool ok = head.magic == MAGIC;
+    const char *p = data + sizeof(head);
+    const char *end = data + st.st_size;
+    for (uint32_t i = 0; ok && i < head.count; i++)
+    {
+        uint16_t len[2];
+        if (end - p < (long)sizeof(len))
+        {
+            ok = false;
+            break;
+        }
+        memcpy(len, p, sizeof(len));
+        p += sizeof(len);
+        if (end - p < len[0] + len[1])
+        {
+            ok = false;
+            break;
+        }
+        std::string name(p, len[0]);
+        p += len[0];
+        insert(name.c_str(), std::string(p, len[1]));
+        p += len[1];
+    }
+    munmap((void *)data, st.st_size);
+    return ok;
+}
+
+#endif // USERSTORE_H
@@ -12,23 +12,151 @@
 #include <arpa/inet.h>
 #include <string.h>
 #include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <algorithm>
 #include <iostream>
 #include <thread>
+#include <vector>
+#include <deque>
 #include "HttpServer.h"
+#include "Router.h"
+#include "UserStore.h"
+#include "Password.h"
+#include "Acceptor.h"
 #include "threadpool.h"
+#include "threadpool2.h"
+#include "FileCache.h"
 #include "../utils/utils.h"
+#include "../utils/Listener.h"
+#include "../utils/Config.h"
+#include "../utils/AllocProfile.h"
 #include "../lock/locker.h"
 #include "../log/AsyncLogger.h"
 #include "../log/Logger.h"
 #include "../log/Localtime.h"
 #include "../clock/minheap.h"
 
-#define SERVERPORT "8888"
-#define MAX_EVENT_NUM 655350
-#define MAX_CLIENTS 300000
+//注册所有配置项：默认值 → --config指定的文件 → 命令行--key=value，见utils/Config.h
+//线程数按CPU核数、连接数组按RLIMIT_NOFILE计算默认值，标记为可热加载的项在SIGHUP时生效
+void init_config()
+{
+    int cores = std::max(1u, std::thread::hardware_concurrency());
+    //fd不会超过RLIMIT_NOFILE，更大的连接数组只会浪费内存
+    int nofile = 300000;
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+        nofile = (int)std::min<rlim_t>(rl.rlim_cur, nofile);
+
+    Config &conf = Config::instance();
+    conf.add_int("port", 8888, 1, 65535, false, "监听端口");
+    conf.add_string("doc_root", "/home/zhl/桌面/MyHttpServer/html", false, "网站根路径");
+    conf.add_int("threads", cores, 1, 1024, false, "处理HTTP请求的线程数，默认等于CPU核数");
+    conf.add_int("max_requests", 10000, 1, 1 << 20, true, "HTTP线程池队列的上限");
+    conf.add_int("crypto_threads", std::max(2, cores / 4), 1, 256, false, "口令哈希线程数");
+    conf.add_int("crypto_max_requests", 64, 1, 1 << 16, true, "口令哈希队列的上限，超过时返回503");
+    conf.add_int("queue_target_us", 5000, 0, 10000000, true, "HTTP线程池排队时间的目标(微秒)，持续超过时按CoDel的间隔对请求返回503，0表示关闭");
+    conf.add_int("queue_interval_us", 100000, 1000, 10000000, true, "排队时间持续超过目标这么久才开始拒绝，也是拒绝间隔的初始值，之后按1/sqrt(次数)缩短(微秒)");
+    conf.add_int("shed_read_budget", 16, 1, 1 << 16, true, "过载时每轮最多读取的连接，其余的请求留在socket缓冲区中");
+    //请求类别的权重和并发上限，类别见Router.h；动态请求默认最多占用一半的线程，静态文件和健康检查总有线程可用
+    //-1表示threads的一半，在apply_classes()中按加载后的threads计算
+    const int weights[CLASS_NUM] = {100, 8, 4, 1};
+    const int limits[CLASS_NUM] = {0, 0, 0, -1};
+    for (int i = 0; i < CLASS_NUM; i++)
+    {
+        std::string name = Router::class_name(i);
+        conf.add_int((name + "_weight").c_str(), weights[i], 1, 1000, true, ("请求类别" + name + "在线程池中的调度权重").c_str());
+        conf.add_int((name + "_limit").c_str(), limits[i], -1, 1024, true, ("请求类别" + name + "同时占用的线程上限，0表示不限，-1表示threads的一半").c_str());
+    }
+    conf.add_int("max_clients", nofile, 16, 1 << 22, false, "同时服务的连接上限，也是连接数组的大小，默认等于RLIMIT_NOFILE");
+    conf.add_int("event_batch", 1024, 1, 1 << 16, false, "每次epoll_wait最多取出的事件数");
+    conf.add_int("accept_budget", 64, 1, 1 << 16, true, "每轮最多接受的连接，剩下的连接下一轮继续");
+    conf.add_int("read_budget", 256, 1, 1 << 16, true, "每轮最多读取的连接，超出的推迟到下一轮");
+    conf.add_int("write_budget", 256, 1, 1 << 16, true, "每轮最多发送的连接，超出的推迟到下一轮");
+    conf.add_int("backlog", 1024, 1, 65535, false, "listen()的backlog，上限是net.core.somaxconn");
+    conf.add_int("defer_accept", 1, 0, 3600, false, "TCP_DEFER_ACCEPT的秒数，0表示关闭");
+    conf.add_int("fastopen", 256, 0, 65535, false, "TCP_FASTOPEN的队列长度，0表示关闭");
+    conf.add_int("nodelay", 1, 0, 1, false, "关闭Nagle算法");
+    conf.add_int("quickack", 0, 0, 1, true, "新连接立即确认第一个请求");
+    conf.add_string("user_snapshot", "users.db", false, "用户表快照文件，为空则不保存");
+    conf.add_string("log_level", "trace", true, "日志级别", "trace|debug|info|warn|error");
+    conf.add_int("shutdown_timeout", 10, 0, 3600, true, "SIGTERM后等待正在处理的请求完成的最长时间(秒)");
+    conf.add_int("file_cache_mb", 64, 0, 1 << 20, true, "静态文件缓存的总大小(MB)，0表示不缓存");
+    conf.add_int("file_cache_max_kb", 1024, 0, 1 << 20, true, "超过这个大小(KB)的文件不缓存，使用mmap发送");
+    conf.add_int("compress_threads", 1, 1, 64, false, "填充文件缓存时生成压缩版本的线程数");
+    conf.add_int("cache_max_age", 60, 0, 31536000, true, "静态文件Cache-Control的max-age(秒)，0表示每次都要重新验证；已经缓存的文件不受影响");
+    conf.add_int("gzip_level", 9, 0, 9, true, "缓存文件的gzip压缩级别，0表示不生成gzip版本");
+#ifdef HAVE_BROTLI
+    conf.add_int("brotli_quality", 11, 0, 11, true, "缓存文件的brotli压缩质量，0表示不生成brotli版本");
+#endif
+#ifdef HAVE_COROUTINE
+    conf.add_int("coroutine", 1, 0, 1, false, "在主线程中用协程处理连接，不经过HTTP线程池，见Coroutine.h");
+#endif
+}
+
+//把请求类别的权重和并发上限应用到线程池，启动时和SIGHUP时调用
+void apply_classes(ThreadPool<HttpServer> &threadpool)
+{
+    Config &conf = Config::instance();
+    for (int i = 0; i < CLASS_NUM; i++)
+    {
+        std::string name = Router::class_name(i);
+        int limit = conf.get_int((name + "_limit").c_str());
+        if (limit < 0)
+            limit = std::max(1, conf.get_int("threads") / 2);
+        threadpool.set_class(i, name.c_str(), conf.get_int((name + "_weight").c_str()), limit);
+    }
+}
+
+//把文件缓存的上限和压缩级别应用到FileCache，启动时和SIGHUP时调用；已经缓存的文件不会重新压缩
+void apply_file_cache()
+{
+    Config &conf = Config::instance();
+#ifdef HAVE_BROTLI
+    int brotli_quality = conf.get_int("brotli_quality");
+#else
+    int brotli_quality = 0;
+#endif
+    FileCache::instance().configure((size_t)conf.get_int("file_cache_mb") << 20, (size_t)conf.get_int("file_cache_max_kb") << 10,
+                                    conf.get_int("gzip_level"), brotli_quality, conf.get_int("cache_max_age"));
+}
+
+//log_level的取值已经由Config检查过
+clog::Logger::LogLevel log_level(const std::string &name)
+{
+    static const char *names[] = {"trace", "debug", "info", "warn", "error"};
+    for (int i = 0; i < 5; i++)
+    {
+        if (name == names[i])
+            return clog::Logger::LogLevel(i);
+    }
+    return clog::Logger::INFO;
+}
+
+//启动时检查配置项之间的关系，出错时返回false
+bool check_config(std::string &err)
+{
+    Config &conf = Config::instance();
+    struct stat st;
+    const std::string &root = conf.get_string("doc_root");
+    if (stat(root.c_str(), &st) < 0 || !S_ISDIR(st.st_mode))
+    {
+        err = "config: doc_root " + root + " is not a directory";
+        return false;
+    }
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY && (rlim_t)conf.get_int("max_clients") > rl.rlim_cur)
+    {
+        fprintf(stderr, "config: max_clients %d is larger than RLIMIT_NOFILE %llu\n", conf.get_int("max_clients"), (unsigned long long)rl.rlim_cur);
+    }
+    return true;
+}
 
-std::map<std::string, std::string> users; //保存post请求体的数据
-locker m_userslock;                       //保护users临界资源
+//登录、注册后返回的页面，在init_routes()中解析
+static const StaticFile *welcome_page;
+static const StaticFile *log_page;
+static const StaticFile *log_error_page;
+static const StaticFile *register_error_page;
 
 static int pipefd[2];
 static int epfd = 0; //监听所有socket的epoll
@@ -55,31 +183,124 @@ void addsig(int sig, void(handler)(int), bool restart = true)
     assert(sigaction(sig, &sa, NULL) != -1);
 }
 
-//创建并监听lfd
-int initSocket(int &lfd, struct sockaddr_in laddr)
+//解析POST请求体中的用户名和密码：user=123&password=123
+bool parse_user(const char *content, char *name, char *password, int size)
+{
+    if (!content || strncmp(content, "user=", 5) != 0)
+        return false;
+    content += 5;
+    int i = 0;
+    for (; *content && *content != '&' && i < size - 1; ++content, ++i)
+        name[i] = *content;
+    name[i] = '\0';
+    if (strncmp(content, "&password=", 10) != 0)
+        return false;
+    content += 10;
+    for (i = 0; *content && i < size - 1; ++content, ++i)
+        password[i] = *content;
+    password[i] = '\0';
+    return true;
+}
+
+//校验登录：若用户存在且口令哈希一致，返回欢迎页面，在crypto线程池中执行
+const StaticFile *verify_login(HttpRequest *req)
+{
+    char name[100], pass[100];
+    parse_user(req->get_content(), name, pass, sizeof(name));
+    std::string stored;
+    if (UserStore::instance().find(name, stored) && password::verify(pass, stored))
+        return welcome_page;
+    return log_error_page;
+}
+
+//注册：查找和插入在同一把分片写锁内完成，多个用户同时注册相同用户名时只有一个成功，在crypto线程池中执行
+const StaticFile *create_user(HttpRequest *req)
+{
+    char name[100], pass[100];
+    parse_user(req->get_content(), name, pass, sizeof(name));
+    std::string stored;
+    //用户已存在时不用再计算哈希
+    if (UserStore::instance().find(name, stored))
+        return register_error_page;
+    if (UserStore::instance().insert(name, password::hash(pass)))
+        return log_page;
+    return register_error_page;
+}
+
+//登录、注册：检查表单后挂起请求，口令哈希交给crypto线程池，不占用处理静态文件的线程
+bool on_login(HttpRequest *req, const RouteMatch &)
 {
-    users["123"] = "123"; //初始化一条数据：用户名、密码
+    char name[100], pass[100];
+    if (!parse_user(req->get_content(), name, pass, sizeof(name)))
+        return false;
+    LOG_INFO << "login user = " << name;
+    req->defer(verify_login);
+    return true;
+}
 
-    int ret;
-    //创建lfd，配置lfd
-    lfd = socket(AF_INET, SOCK_STREAM, 0);
-    laddr.sin_family = AF_INET;
-    laddr.sin_port = htons(atoi(SERVERPORT));
-    inet_pton(AF_INET, "0.0.0.0", &laddr.sin_addr);
+//健康检查：不读文件、不访问用户表，直接返回预先生成的200
+bool on_health(HttpRequest *req, const RouteMatch &)
+{
+    req->set_canned(200);
+    return true;
+}
 
-    int flag = 1;
-    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+bool on_register(HttpRequest *req, const RouteMatch &)
+{
+    char name[100], pass[100];
+    if (!parse_user(req->get_content(), name, pass, sizeof(name)))
+        return false;
+    LOG_INFO << "register user = " << name;
+    req->defer(create_user);
+    return true;
+}
 
-    //绑定
-    ret = bind(lfd, (struct sockaddr *)&laddr, sizeof(laddr));
-    assert(ret >= 0);
+//注册路由，启动时调用一次
+void init_routes()
+{
+    Router &router = Router::instance();
+    router.set_doc_root(Config::instance().get_string("doc_root").c_str());
+    /*
+    "/"    返回判断页面    judge.html
+    "/0"   返回注册页面    register.html
+    "/1"   返回登录页面    log.html
+    "/2"   登录，返回欢迎页面 welcome.html
+    "/3"   注册，返回登录页面    log.html
+    "/4"   返回图片资源    picture.html
+    "/5"   返回视频资源    video.html
+    */
+    router.add_file(Router::ANY, "/", "/judge.html");
+    router.add_file(Router::ANY, "/0", "/register.html");
+    router.add_file(Router::ANY, "/1", "/log.html");
+    router.add_file(Router::ANY, "/4", "/picture.html");
+    router.add_file(Router::ANY, "/5", "/video.html");
+    //表单提交到"2CGISQL.cgi"、"3CGISQL.cgi"
+    router.add_handler(Router::POST, "/2*", on_login);
+    router.add_handler(Router::POST, "/3*", on_register);
+    //负载均衡器的健康检查，使用最高优先级的类别，服务繁忙时也能及时响应
+    router.add_handler(Router::GET, "/health", on_health, CLASS_HEALTH);
 
-    //监听
-    ret = listen(lfd, 127);
-    assert(ret >= 0);
+    welcome_page = router.file("/welcome.html");
+    log_page = router.file("/log.html");
+    log_error_page = router.file("/logError.html");
+    register_error_page = router.file("/registerError.html");
+}
 
-    //std::cout << "lfd = " << lfd << std::endl;
+//创建并监听lfd
+//创建lfd：backlog、TCP_DEFER_ACCEPT、TCP_FASTOPEN等选项见utils/Listener.h
+int initSocket(int &lfd)
+{
+    Config &conf = Config::instance();
+    ListenOptions &opts = Listener::instance().options();
+    opts.backlog = conf.get_int("backlog");
+    opts.defer_accept = conf.get_int("defer_accept");
+    opts.fastopen = conf.get_int("fastopen");
+    opts.nodelay = conf.get_int("nodelay");
+    opts.quickack = conf.get_int("quickack");
+    lfd = Listener::instance().open("0.0.0.0", conf.get_int("port"));
+    assert(lfd >= 0);
     LOG_INFO << "lfd =" << lfd;
+    return lfd;
 }
 
 void tf1()
@@ -91,7 +312,17 @@ int main(int argc, char const *argv[])
 {
 
     using namespace clog;
-    Logger::setLogLevel(Logger::TRACE);
+    init_config();
+    Config &conf = Config::instance();
+    std::string err;
+    if (!conf.load(argc, argv, err) || !check_config(err))
+    {
+        //--help时err为空
+        if (!err.empty())
+            fprintf(stderr, "%s\n", err.c_str());
+        return err.empty() ? 0 : 1;
+    }
+    Logger::setLogLevel(log_level(conf.get_string("log_level")));
     Logger::setConcurrentMode();
     Localtime begin(Localtime::now());
 
@@ -100,16 +331,45 @@ int main(int argc, char const *argv[])
     t.join();
 
     int lfd;                  //监听HttpServer的lfd
-    struct sockaddr_in laddr; //服务端sockert地址
-    epoll_event events[MAX_EVENT_NUM];
+    //事件数组放在堆上，大小和连接数无关
+    std::vector<epoll_event> events(conf.get_int("event_batch"));
+    //超过本轮预算、推迟到下一轮的连接，事件保存在HttpServer::m_deferred中
+    std::deque<int> deferred;
+
+    //启动时生成错误响应，之后所有连接只读共享
+    header::CannedResponses::instance();
+    init_routes();
+
+    const std::string snapshot = conf.get_string("user_snapshot");
+    if (!snapshot.empty() && UserStore::instance().load(snapshot.c_str()))
+        LOG_INFO << "load " << UserStore::instance().size() << " users from " << snapshot.c_str();
+    UserStore::instance().insert("123", password::hash("123")); //初始化一条数据：用户名、密码
 
     //创建用于HTTP服务的线程池
-    ThreadPool<HttpServer> &threadpool = ThreadPool<HttpServer>::create();
+    ThreadPool<HttpServer> &threadpool = ThreadPool<HttpServer>::create(conf.get_int("threads"), conf.get_int("max_requests"));
+    //口令哈希使用独立的线程池和队列上限，登录请求的排队不影响静态文件
+    ThreadPool<DeferredTask> &cryptopool = ThreadPool<DeferredTask>::create(conf.get_int("crypto_threads"), conf.get_int("crypto_max_requests"));
+    threadpool.set_codel(conf.get_int("queue_target_us"), conf.get_int("queue_interval_us"));
+    apply_classes(threadpool);
+    //压缩只在填充文件缓存时进行，使用独立的执行器，不占用处理请求的线程
+    Executor &compressor = Executor::create(conf.get_int("compress_threads"), 1024);
+    FileCache::instance().set_executor(&compressor);
+    FileCache::instance().set_root(Router::instance().doc_root());
+    apply_file_cache();
+    for (auto &file : Router::instance().files())
+        FileCache::instance().preload(file->path.c_str());
 
     // //预先为每个可能的客户连接分配一个 HttpServer 对象
-    HttpServer *users = new HttpServer[MAX_CLIENTS];
+    const int max_clients = conf.get_int("max_clients");
+    HttpServer *users = new HttpServer[max_clients];
 
-    initSocket(lfd, laddr);
+    initSocket(lfd);
+    //一轮中连续accept，直到EAGAIN或者用完预算
+    setnonblocking(lfd);
+    Acceptor acceptor(lfd, max_clients, conf.get_int("accept_budget"));
+    //每轮的读写预算，SIGHUP时更新
+    int read_budget = conf.get_int("read_budget"), write_budget = conf.get_int("write_budget");
+    int shed_read_budget = conf.get_int("shed_read_budget");
 
     epfd = epoll_create(1);
     assert(epfd != -1);
@@ -123,42 +383,145 @@ int main(int argc, char const *argv[])
     setnonblocking(pipefd[1]);
     addfd(epfd, pipefd[0], false);
 
+#ifdef HAVE_COROUTINE
+    //协程模式下连接上的事件交给调度器，HTTP线程池不再使用，crypto线程池通过eventfd交还挂起的协程
+    coro::Scheduler *sched = conf.get_int("coroutine") ? new coro::Scheduler(epfd, max_clients) : nullptr;
+#endif
+
     addsig(SIGTERM, sig_handler, false);
+    addsig(SIGUSR1, sig_handler);
+    addsig(SIGHUP, sig_handler);
+
+    //收到SIGTERM后排空：不再接受连接和新的请求，等正在处理的请求发送完响应或者超时
+    bool draining = false;
+    time_t drain_deadline = 0;
+
+    //处理客户连接上的事件：可读时读取请求并交给线程池，可写时发送响应，失败时关闭连接
+    auto handle_client = [&](int sockfd, uint32_t ev) {
+#ifdef HAVE_COROUTINE
+        //协程模式：恢复等待这个fd的协程，读写和排空都由协程处理
+        if (sched)
+        {
+            sched->on_event(sockfd);
+            return;
+        }
+#endif
+        //处理客户连接上接收到的数据
+        if (ev & EPOLLIN)
+        {
+            //排空期间keep-alive连接上的新请求不再处理，直接关闭
+            if (draining)
+            {
+                users[sockfd].close_conn();
+            }
+            else if (users[sockfd].read())
+            {
+                //若监测到读事件，将该事件放入请求队列，线程池有任务后会执行process()
+                //process()负责处理http request和http response
+                users[sockfd].start_request();
+                //按请求行中的路由分类，不同类别进入线程池中不同的队列
+                //队列已满或者排队时间持续超过目标：立即返回503，不让请求继续排队
+                if (!threadpool.append(users + sockfd, users[sockfd].request_class()))
+                {
+                    LOG_DEBUG << "request queue is overloaded, reject client fd=" << sockfd;
+                    users[sockfd].reject();
+                }
+            }
+            else
+            {
+                users[sockfd].close_conn();
+            }
+        }
+        else if (ev & EPOLLOUT)
+        {
+            if (!users[sockfd].write())
+            {
+                users[sockfd].close_conn();
+            }
+        }
+        else
+        {
+            users[sockfd].close_conn();
+        }
+    };
 
     bool stop_server = false;
     while (!stop_server)
     {
-        int n = epoll_wait(epfd, events, MAX_EVENT_NUM, -1);
+        //还有推迟的连接时只检查新事件，不等待
+        //排空期间定期醒来检查截止时间
+        int timeout = !deferred.empty() ? 0 : draining ? 100 : -1;
+#ifdef HAVE_COROUTINE
+        //协程模式下还要在最近的sleep_for()到期时醒来
+        if (sched)
+            timeout = sched->next_timeout(timeout);
+#endif
+        int n = epoll_wait(epfd, events.data(), events.size(), timeout);
         if ((n < 0) && (errno != EINTR))
         {
             perror("epoll_wait()");
             LOG_ERROR << "epoll_wait()" << errno;
             exit(1);
         }
+        //本轮剩余的读写预算；线程池过载时少读一些连接，读出来的请求也只能返回503，
+        //留在socket缓冲区中的请求可以等过载结束后再处理，客户端也会因为TCP窗口变小而放慢
+        int reads = threadpool.overloaded() ? std::min(read_budget, shed_read_budget) : read_budget;
+        int writes = write_budget;
+        auto take = [&](uint32_t ev) -> bool {
+            //只有错误、挂断的事件直接处理
+            if (!(ev & (EPOLLIN | EPOLLOUT)))
+            {
+                return true;
+            }
+            int &left = (ev & EPOLLIN) ? reads : writes;
+            if (left == 0)
+            {
+                return false;
+            }
+            left--;
+            return true;
+        };
+        //先处理上一轮留下的连接
+        for (size_t k = deferred.size(); k > 0; k--)
+        {
+            int sockfd = deferred.front();
+            deferred.pop_front();
+            uint32_t ev = users[sockfd].m_deferred;
+            if (!take(ev))
+            {
+                deferred.push_back(sockfd);
+                continue;
+            }
+            users[sockfd].m_deferred = 0;
+            handle_client(sockfd, ev);
+        }
         for (int i = 0; i < n; i++)
         {
             int sockfd = events[i].data.fd;
             if (sockfd == lfd)
             {
-                struct sockaddr_in raddr;
-                socklen_t raddr_len = sizeof(raddr);
-                int cfd = accept(sockfd, (struct sockaddr *)&raddr, &raddr_len);
-                if (cfd < 0)
+                //同一批事件中先处理了SIGTERM，lfd已经关闭
+                if (draining)
                 {
-                    //fprintf(stdout, "errno is :%d\n", errno);
-                    LOG_ERROR << "accpet() errno " << errno;
                     continue;
                 }
-                if (HttpServer::m_user_count >= MAX_CLIENTS)
-                {
-                    printf("Internal server busy\n");
-                    LOG_ERROR << "Internal server busy";
-                    continue;
-                }
-                users[cfd].init(cfd, raddr);
-                printf("accept %dth new client ..\n", HttpServer::m_user_count);
-                LOG_INFO << "accept " << HttpServer::m_user_count << "th new client ..";
+                acceptor.accept_batch(HttpServer::m_user_count.load(), [&](int cfd, struct sockaddr_in &raddr) {
+                    Listener::instance().tune(cfd);
+                    users[cfd].init(cfd, raddr);
+#ifdef HAVE_COROUTINE
+                    if (sched)
+                        users[cfd].serve(*sched);
+#endif
+                    LOG_INFO << "accept " << HttpServer::m_user_count.load() << "th new client ..";
+                });
             }
+#ifdef HAVE_COROUTINE
+            //crypto线程池交还的协程
+            else if (sched && sockfd == sched->event_fd())
+            {
+                sched->run_posted();
+            }
+#endif
             //处理信号
             else if ((sockfd == pipefd[0]) && (events[i].events & EPOLLIN))
             {
@@ -177,42 +540,109 @@ int main(int argc, char const *argv[])
                         {
                         case SIGTERM:
                         {
-                            stop_server = true;
+                            if (draining)
+                            {
+                                break;
+                            }
+                            //先停止接受连接，监听队列中还没有accept的连接由内核重置
+                            draining = true;
+                            drain_deadline = time(nullptr) + conf.get_int("shutdown_timeout");
+#ifdef HAVE_COROUTINE
+                            if (sched)
+                                sched->stop();
+#endif
+                            LOG_INFO << acceptor.report().c_str();
+                            delfd(epfd, lfd);
+                            close(lfd);
+                            LOG_INFO << "draining, " << HttpServer::report().c_str();
+                            break;
+                        }
+                        //kill -USR1输出接受器的计数
+                        case SIGUSR1:
+                        {
+                            std::string report = acceptor.report() + "\n" + HttpServer::report() + "\n" +
+                                                 threadpool.report("http_queue") + "\n" + cryptopool.report("crypto_queue") + "\n" +
+                                                 compressor.report("compress_queue") + "\n" + FileCache::instance().report();
+#ifdef ALLOC_PROFILE
+                            //两次SIGUSR1之间每个请求的分配次数，用来确认keep-alive请求稳定后不再分配内存
+                            report += "\n" + AllocProfile::instance().report(HttpServer::m_stats.completed);
+#endif
+                            printf("%s\n", report.c_str());
+                            fflush(stdout);
+                            LOG_INFO << report.c_str();
+                            break;
+                        }
+                        //kill -HUP重新加载配置，只有标记为可热加载的项生效，已有的连接不受影响
+                        case SIGHUP:
+                        {
+                            std::vector<std::string> changed;
+                            if (!conf.reload(err, changed))
+                            {
+                                fprintf(stderr, "%s\n", err.c_str());
+                                LOG_ERROR << "reload failed: " << err.c_str();
+                                break;
+                            }
+                            threadpool.set_max_requests(conf.get_int("max_requests"));
+                            cryptopool.set_max_requests(conf.get_int("crypto_max_requests"));
+                            threadpool.set_codel(conf.get_int("queue_target_us"), conf.get_int("queue_interval_us"));
+                            apply_classes(threadpool);
+                            apply_file_cache();
+                            shed_read_budget = conf.get_int("shed_read_budget");
+                            acceptor.set_batch(conf.get_int("accept_budget"));
+                            read_budget = conf.get_int("read_budget");
+                            write_budget = conf.get_int("write_budget");
+                            Listener::instance().options().quickack = conf.get_int("quickack");
+                            for (const std::string &key : changed)
+                                LOG_INFO << "reload " << key.c_str();
+                            Logger::setLogLevel(log_level(conf.get_string("log_level")));
+                            break;
                         }
                         }
                     }
                 }
             }
-            //处理客户连接上接收到的数据，发生可读事件，定时器延长
-            else if (events[i].events & EPOLLIN)
+            //客户连接注册了EPOLLONESHOT，推迟处理期间不会重复触发，也不会被线程池访问
+            else if (take(events[i].events))
             {
-                //auto timer = users_clocks[sockfd].timer;
-                if (users[sockfd].read())
-                {
-                    //若监测到读事件，将该事件放入请求队列，线程池有任务后会执行process()
-                    //process()负责处理http request和http response
-                    threadpool.append(users + sockfd);
-                }
-            }
-            else if (events[i].events & EPOLLOUT)
-            {
-                if (users[sockfd].write())
-                {
-                    std::cout << "send data to the client fd=" << sockfd << std::endl;
-                }
+                handle_client(sockfd, events[i].events);
             }
             else
             {
-                std::cout << "something else" << std::endl;
+                users[sockfd].m_deferred = events[i].events;
+                deferred.push_back(sockfd);
             }
         }
+#ifdef HAVE_COROUTINE
+        if (sched)
+            sched->run_timers();
+#endif
+        //所有请求都已发送完响应，或者超过了截止时间
+        if (draining && (HttpServer::in_flight() == 0 || time(nullptr) >= drain_deadline))
+        {
+            stop_server = true;
+        }
     }
+    //执行完队列中剩下的任务后回收线程：HTTP线程池的任务可能挂起到crypto线程池，所以先停止HTTP线程池
+    //之后不会再有线程访问users
+    threadpool.stop();
+    cryptopool.stop();
+    compressor.stop();
+#ifdef HAVE_COROUTINE
+    //销毁还在等待的协程（空闲的keep-alive连接等）
+    delete sched;
+#endif
+    std::string report = HttpServer::report() + "\n" + threadpool.report("http_queue") + "\n" + cryptopool.report("crypto_queue");
+    printf("%s\n", report.c_str());
+    LOG_INFO << "stopped, " << report.c_str();
     close(epfd);
-    close(lfd);
     close(pipefd[1]);
     close(pipefd[0]);
     delete[] users;
+    if (!snapshot.empty())
+        UserStore::instance().save(snapshot.c_str());
     double times = timeDifference(Localtime::now(), begin);
     printf("Time is %10.4lf s\n", times);
+    //写出所有日志后退出
+    Logger::finishConcurrent();
     return 0;
 }
\ No newline at end of file
@@ -1,23 +1,78 @@
 /**
  * @author: fenghaze
  * @date: 2021/07/13 16:55
- * @desc: 线程池，维护一个任务队列
+ * @desc: 线程池，维护一个多级任务队列
+ * stop()之后不再接受新任务，工作线程取完队列中剩下的任务后退出，stop()等待所有线程结束
+ * 优先级：任务按类别进入各自的队列，每个类别有权重和并发上限(0表示不限)
+ * 工作线程在有任务、且没有达到并发上限的类别之间按平滑加权轮询(nginx的smooth weighted round-robin)选择下一个任务，
+ * 权重悬殊时接近严格优先级；并发上限保证慢的类别不会占满所有线程
+ * 准入控制（CoDel）：每个任务记录入队时间，工作线程取出时得到排队时间(sojourn)，每个类别单独判断
+ * 排队时间连续一个interval都超过target时该类别进入过载状态，并丢弃取出的任务：调用task->shed()快速返回503
+ * 过载状态中按CoDel的控制律丢弃：第count次丢弃之后，间隔interval/sqrt(count)再丢弃下一个，
+ * 积压持续时丢弃越来越密，直到排队时间降到target以下；丢弃的时刻到了以后，append()先拒绝新任务，
+ * 调用方返回503，新任务不必排队；取出的任务排队时间低于target时退出过载状态，count清零
+ * 任务类型T需要提供process()和shed()
  */
 
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
 
-#include <list>
 #include <vector>
 #include <exception>
+#include <math.h>
 #include <pthread.h>
+#include <atomic>
+#include <string>
+#include "Histogram.h"
 #include "../lock/locker.h"
 #include "../log/AsyncLogger.h"
 #include "../log/Logger.h"
+
+//环形队列：容量不够时翻倍，出队不释放内存，稳定后入队、出队都不分配内存（std::list每个节点分配一次）
+template <class T>
+class RingQueue
+{
+public:
+    RingQueue() : m_head(0), m_size(0) {}
+    bool empty() const { return m_size == 0; }
+    size_t size() const { return m_size; }
+    T &front() { return m_buf[m_head]; }
+    void push_back(const T &value)
+    {
+        if (m_size == m_buf.size())
+            grow();
+        m_buf[(m_head + m_size) & (m_buf.size() - 1)] = value;
+        m_size++;
+    }
+    void pop_front()
+    {
+        m_head = (m_head + 1) & (m_buf.size() - 1);
+        m_size--;
+    }
+
+private:
+    //容量保持2的幂，下标用&代替%
+    void grow()
+    {
+        std::vector<T> buf(m_buf.empty() ? 64 : m_buf.size() * 2);
+        for (size_t i = 0; i < m_size; i++)
+            buf[i] = m_buf[(m_head + i) & (m_buf.size() - 1)];
+        m_buf.swap(buf);
+        m_head = 0;
+    }
+
+    std::vector<T> m_buf;
+    size_t m_head; //队首的下标
+    size_t m_size; //元素个数
+};
+
 template <class T>
 class ThreadPool
 {
 public:
+    //任务类别的最大数量，类别编号为[0, MAX_CLASSES)
+    static const int MAX_CLASSES = 4;
+
     //懒汉模式
     static ThreadPool<T> &create(int thread_number = 6, int max_requests = 10000)
     {
@@ -25,35 +80,109 @@ public:
         return mInstance;
     }
 
-    //向任务队列中添加T类型任务
-    bool append(T *task);
+    //向cls类别的任务队列中添加任务：已经停止、队列已满或者该类别按CoDel的间隔需要丢弃时返回false
+    bool append(T *task, int cls = 0);
+
+    //设置类别的名称、权重和并发上限(0表示不限)，可以在运行时修改（SIGHUP重新加载配置）
+    void set_class(int cls, const char *name, int weight, int limit);
+
+    //设置CoDel的参数(微秒)，target为0时关闭准入控制，只按队列长度拒绝
+    void set_codel(int target_us, int interval_us);
+
+    //是否处于过载状态：有任务排队的类别都在过载，主线程据此减少每轮读取的连接
+    bool overloaded() const { return m_overloaded.load(std::memory_order_relaxed); }
+
+    //每个类别的排队时间分位数和拒绝的任务数
+    std::string report(const char *name) const;
+
+    //修改队列上限（SIGHUP重新加载配置），已经在队列中的任务不受影响
+    void set_max_requests(int max_requests);
+
+    //停止线程池：执行完队列中的任务后回收所有线程，可以重复调用
+    void stop();
 
 private:
-    //创建工作线程，并分离
+    //创建工作线程，由stop()回收
     ThreadPool(int thread_number, int max_requests);
     ~ThreadPool();
     //工作线程运行的函数，内部调用run()
     static void *worker(void *arg);
-    //线程调用的函数，即线程创建后就一直等待信号量m_queuestat，从任务队列中取任务来执行
+    //线程调用的函数，即线程创建后就一直等待条件变量m_queuecond，从任务队列中取任务来执行
     void run();
+    //按加权轮询选择下一个类别，没有可以执行的任务时返回-1，调用时持有m_queuelocker
+    int pick();
+    //CoDel：根据取出的任务的排队时间更新类别的过载状态，返回是否丢弃该任务，调用时持有m_queuelocker
+    bool codel(int cls, uint64_t sojourn, uint64_t now);
+    //过载状态中丢弃的时刻是否已到，到了则计数并安排下一次丢弃，调用时持有m_queuelocker
+    bool drop_due(int cls, uint64_t now);
+    //CoDel的控制律：第count次丢弃之后，间隔interval/sqrt(count)丢弃下一个
+    uint64_t control_law(uint64_t t, uint32_t count) const;
 
 private:
     int m_thread_number;        //线程池中的线程数
-    int m_max_requests;         //请求队列中允许的最大请求数
+    int m_max_requests;         //所有类别的队列中允许的最大请求数
     pthread_t *m_threads;       //描述线程池的数组，其大小为m_thread_number
-    std::list<T *> m_workqueue; //任务队列
+    //任务和入队时间(微秒)
+    struct Entry
+    {
+        T *task;
+        uint64_t enqueued;
+    };
+    //一个类别的队列和调度状态，除原子变量外由m_queuelocker保护
+    struct Class
+    {
+        RingQueue<Entry> queue; //任务队列
+        std::string name;       //report()中的名称
+        int weight;             //加权轮询的权重
+        int limit;              //同时执行的任务上限，0表示不限
+        int running;            //正在执行的任务
+        int current;            //加权轮询的当前值
+        uint64_t first_above;   //排队时间第一次超过目标的时刻加上interval，0表示低于目标
+        uint64_t drop_next;     //过载状态中下一次丢弃的时刻
+        uint32_t count;         //本次过载状态中丢弃的任务数，决定丢弃的间隔
+        std::atomic<bool> dropping;       //过载状态
+        std::atomic<uint64_t> rejected;   //过载时append()拒绝的任务
+        std::atomic<uint64_t> shed;       //过载时排队超过目标、没有执行就调用shed()的任务
+        std::atomic<uint64_t> executed;   //执行过process()的任务
+        Histogram sojourn;                //排队时间(微秒)
+    };
+    Class m_classes[MAX_CLASSES];
+    size_t m_queued;            //所有类别中排队的任务数
     locker m_queuelocker;       //保护请求队列的互斥锁
-    sem m_queuestat;            //是否有任务需要处理
-    bool m_stop;                //是否结束线程
+    cond m_queuecond;           //有新任务，或者有并发上限的类别空出了位置
+    bool m_stop;                //是否结束线程，由m_queuelocker保护
+
+    /*CoDel准入控制的参数，由m_queuelocker保护*/
+    uint64_t m_target_us;            //排队时间的目标，0表示关闭
+    uint64_t m_interval_us;          //排队时间超过目标持续这么久才进入过载状态，也是丢弃间隔的初始值
+    std::atomic<bool> m_overloaded;  //有任务排队的类别都在过载
+    std::atomic<uint64_t> m_full;    //队列已满时拒绝的任务
 };
 
 template <class T>
-ThreadPool<T>::ThreadPool(int thread_number, int max_requests) : m_thread_number(thread_number), m_max_requests(max_requests)
+ThreadPool<T>::ThreadPool(int thread_number, int max_requests)
+    : m_thread_number(thread_number), m_max_requests(max_requests), m_queued(0), m_target_us(0), m_interval_us(100000),
+      m_overloaded(false), m_full(0)
 {
     m_stop = false;
     m_threads = nullptr;
     if (thread_number <= 0 || max_requests <= 0)
         throw std::exception();
+    for (int i = 0; i < MAX_CLASSES; i++)
+    {
+        Class &c = m_classes[i];
+        c.weight = 1;
+        c.limit = 0;
+        c.running = 0;
+        c.current = 0;
+        c.first_above = 0;
+        c.drop_next = 0;
+        c.count = 0;
+        c.dropping = false;
+        c.rejected = 0;
+        c.shed = 0;
+        c.executed = 0;
+    }
     m_threads = new pthread_t[m_thread_number];
     if (!m_threads)
         throw std::exception();
@@ -63,11 +192,8 @@ ThreadPool<T>::ThreadPool(int thread_number, int max_requests) : m_thread_number
         LOG_INFO << "create the " << i+1 << "th thread";
         if (pthread_create(m_threads + i, nullptr, worker, this) != 0)
         {
-            delete[] m_threads;
-            throw std::exception();
-        }
-        if (pthread_detach(m_threads[i]))
-        {
+            m_thread_number = i;
+            stop();
             delete[] m_threads;
             throw std::exception();
         }
@@ -77,27 +203,126 @@ ThreadPool<T>::ThreadPool(int thread_number, int max_requests) : m_thread_number
 template <class T>
 ThreadPool<T>::~ThreadPool()
 {
+    stop();
     delete[] m_threads;
+}
+
+template <class T>
+void ThreadPool<T>::stop()
+{
+    m_queuelocker.lock();
+    if (m_stop)
+    {
+        m_queuelocker.unlock();
+        return;
+    }
     m_stop = true;
+    m_queuelocker.unlock();
+    //唤醒所有线程：线程在队列为空时才退出，队列中的任务都会被执行
+    m_queuecond.broadcast();
+    for (int i = 0; i < m_thread_number; i++)
+    {
+        pthread_join(m_threads[i], nullptr);
+    }
+    LOG_INFO << "threadpool stopped, " << m_thread_number << " threads joined";
 }
 
 template <class T>
-bool ThreadPool<T>::append(T *task)
+bool ThreadPool<T>::append(T *task, int cls)
 {
+    if (cls < 0 || cls >= MAX_CLASSES)
+    {
+        cls = MAX_CLASSES - 1;
+    }
+    Class &c = m_classes[cls];
     m_queuelocker.lock();
-    //超过任务限制数，则报错
-    if(m_workqueue.size() > m_max_requests)
+    //超过任务限制数或者已经停止，则报错
+    if (m_stop || m_queued > (size_t)m_max_requests)
     {
         m_queuelocker.unlock();
+        m_full++;
         return false;
     }
-    m_workqueue.push_back(task);
+    //过载时按控制律的间隔拒绝新任务；队列为空时总是接受，它的排队时间很短，取出时会结束过载状态
+    uint64_t now = monotonic_us();
+    if (c.dropping && !c.queue.empty() && drop_due(cls, now))
+    {
+        m_queuelocker.unlock();
+        c.rejected++;
+        return false;
+    }
+    c.queue.push_back(Entry{task, now});
+    m_queued++;
     m_queuelocker.unlock();
-    //信号量增加
-    m_queuestat.post();
+    m_queuecond.signal();
     return true;
 }
 
+template <class T>
+void ThreadPool<T>::set_class(int cls, const char *name, int weight, int limit)
+{
+    if (cls < 0 || cls >= MAX_CLASSES)
+    {
+        return;
+    }
+    m_queuelocker.lock();
+    Class &c = m_classes[cls];
+    c.name = name;
+    c.weight = weight > 0 ? weight : 1;
+    c.limit = limit > 0 ? limit : 0;
+    m_queuelocker.unlock();
+    //上限变大时，等待中的线程可能有任务可以执行了
+    m_queuecond.broadcast();
+}
+
+template <class T>
+void ThreadPool<T>::set_codel(int target_us, int interval_us)
+{
+    m_queuelocker.lock();
+    m_target_us = target_us;
+    m_interval_us = interval_us;
+    for (int i = 0; i < MAX_CLASSES; i++)
+    {
+        m_classes[i].first_above = 0;
+        m_classes[i].count = 0;
+        m_classes[i].dropping = false;
+    }
+    m_overloaded = false;
+    m_queuelocker.unlock();
+}
+
+template <class T>
+std::string ThreadPool<T>::report(const char *name) const
+{
+    std::string out;
+    char buf[256];
+    for (int i = 0; i < MAX_CLASSES; i++)
+    {
+        const Class &c = m_classes[i];
+        //只输出设置过或者用过的类别
+        if (c.name.empty() && c.sojourn.count() == 0)
+        {
+            continue;
+        }
+        std::string label = c.name.empty() ? std::string(name) : std::string(name) + "." + c.name;
+        out += c.sojourn.summary(label.c_str(), "us");
+        snprintf(buf, sizeof(buf), " executed=%llu rejected=%llu shed=%llu weight=%d limit=%d dropping=%d\n",
+                 (unsigned long long)c.executed.load(), (unsigned long long)c.rejected.load(),
+                 (unsigned long long)c.shed.load(), c.weight, c.limit, (int)c.dropping.load());
+        out += buf;
+    }
+    snprintf(buf, sizeof(buf), "%s: full=%llu overloaded=%d", name, (unsigned long long)m_full.load(), (int)overloaded());
+    return out + buf;
+}
+
+template <class T>
+void ThreadPool<T>::set_max_requests(int max_requests)
+{
+    m_queuelocker.lock();
+    m_max_requests = max_requests;
+    m_queuelocker.unlock();
+}
+
 template <class T>
 void *ThreadPool<T>::worker(void *arg)
 {
@@ -106,31 +331,164 @@ void *ThreadPool<T>::worker(void *arg)
     return threadpool;
 }
 
+template <class T>
+int ThreadPool<T>::pick()
+{
+    //平滑加权轮询：每个候选类别的current加上权重，选current最大的，再减去候选类别的权重之和
+    int best = -1, total = 0;
+    for (int i = 0; i < MAX_CLASSES; i++)
+    {
+        Class &c = m_classes[i];
+        if (c.queue.empty() || (c.limit > 0 && c.running >= c.limit))
+        {
+            continue;
+        }
+        c.current += c.weight;
+        total += c.weight;
+        if (best < 0 || c.current > m_classes[best].current)
+        {
+            best = i;
+        }
+    }
+    if (best >= 0)
+    {
+        m_classes[best].current -= total;
+    }
+    return best;
+}
+
+template <class T>
+uint64_t ThreadPool<T>::control_law(uint64_t t, uint32_t count) const
+{
+    return t + static_cast<uint64_t>(m_interval_us / sqrt(static_cast<double>(count)));
+}
+
+template <class T>
+bool ThreadPool<T>::drop_due(int cls, uint64_t now)
+{
+    Class &c = m_classes[cls];
+    if (now < c.drop_next)
+    {
+        return false;
+    }
+    c.count++;
+    c.drop_next = control_law(c.drop_next, c.count);
+    return true;
+}
+
+template <class T>
+bool ThreadPool<T>::codel(int cls, uint64_t sojourn, uint64_t now)
+{
+    //排队时间连续interval都高于目标时才可以丢弃，低于目标时立即重新计时
+    Class &c = m_classes[cls];
+    bool ok_to_drop = false;
+    if (m_target_us == 0 || sojourn < m_target_us)
+    {
+        c.first_above = 0;
+    }
+    else if (c.first_above == 0)
+    {
+        c.first_above = now + m_interval_us;
+    }
+    else if (now >= c.first_above)
+    {
+        ok_to_drop = true;
+    }
+
+    bool shed = false;
+    if (c.dropping)
+    {
+        if (!ok_to_drop)
+        {
+            //积压已经排空，退出过载状态，下次从间隔interval重新开始
+            c.dropping = false;
+            c.count = 0;
+        }
+        else
+        {
+            shed = drop_due(cls, now);
+        }
+    }
+    else if (ok_to_drop)
+    {
+        c.dropping = true;
+        c.count = 1;
+        c.drop_next = control_law(now, c.count);
+        shed = true;
+        LOG_WARN << "queue " << c.name.c_str() << " sojourn " << sojourn << "us above target " << m_target_us << "us, shedding requests";
+    }
+    //有任务排队的类别都在过载时，主线程才减少读取
+    bool overloaded = false;
+    for (int i = 0; i < MAX_CLASSES; i++)
+    {
+        const Class &k = m_classes[i];
+        if (k.queue.empty() && k.running == 0)
+        {
+            continue;
+        }
+        if (!k.dropping)
+        {
+            overloaded = false;
+            break;
+        }
+        overloaded = true;
+    }
+    m_overloaded = overloaded;
+    return shed;
+}
+
 template <class T>
 void ThreadPool<T>::run()
 {
-    while (!m_stop)
+    m_queuelocker.lock();
+    while (true)
     {
-        //等待信号量
-        m_queuestat.wait();
-        //从任务队列中取出任务时需要加锁
-        m_queuelocker.lock();
-        //队列为空，继续等待
-        if (m_workqueue.empty())
+        int cls = pick();
+        if (cls < 0)
         {
-            m_queuelocker.unlock();
+            //所有队列都为空：已经停止则退出，并唤醒其他在等待有限类别空位的线程；
+            //否则等待新任务，或者等待有并发上限的类别空出位置
+            if (m_stop && m_queued == 0)
+            {
+                m_queuecond.broadcast();
+                break;
+            }
+            m_queuecond.wait(m_queuelocker.get());
             continue;
         }
-        T *task = m_workqueue.front();
-        m_workqueue.pop_front();
+        Class &c = m_classes[cls];
+        Entry entry = c.queue.front();
+        c.queue.pop_front();
+        m_queued--;
+        c.running++;
+        uint64_t now = monotonic_us();
+        uint64_t sojourn = now - entry.enqueued;
+        bool shed = codel(cls, sojourn, now);
         m_queuelocker.unlock();
-        if (!task)
+
+        c.sojourn.record(sojourn);
+        T *task = entry.task;
+        if (task && shed)
         {
-            continue;
+            c.shed++;
+            task->shed();
+        }
+        else if (task)
+        {
+            //执行任务
+            c.executed++;
+            task->process();
+        }
+
+        m_queuelocker.lock();
+        c.running--;
+        //有并发上限的类别空出了位置，唤醒一个线程执行它排队的任务
+        if (c.limit > 0 && !c.queue.empty())
+        {
+            m_queuecond.signal();
         }
-        //执行任务
-        task->process(); 
     }
+    m_queuelocker.unlock();
 }
 
-#endif // THREADPOOL_H
\ No newline at end of file
+#endif // THREADPOOL_H
@@ -1,97 +1,283 @@
 /**
  * @author: fenghaze
  * @date: 2021/07/13 16:55
- * @desc: 线程池，维护一个任务队列
+ * @desc: 通用的任务执行器，基于C++11的std::thread、std::mutex和std::condition_variable
+ * 和threadpool.h的ThreadPool<T>不同，任务是任意的可调用对象（包括只能移动的lambda、std::packaged_task），
+ * submit()返回std::future，post()不关心结果；submit_batch()一次加锁提交一批任务
+ * 适合不在请求路径上、可以离开反应堆执行的工作：压缩、口令哈希、日志格式化等
+ * 队列已满或者已经停止时拒绝任务：submit()返回无效的future(valid()为false)，post()返回false，不会阻塞调用方
+ * 任务在锁外执行；stop()之后不再接受新任务，工作线程执行完队列中剩下的任务后退出，stop()等待所有线程结束
  */
 
-#ifndef THREADPOOL_H
-#define THREADPOOL_H
+#ifndef THREADPOOL2_H
+#define THREADPOOL2_H
 
-#include <queue>
+#include <stdint.h>
+#include <stdio.h>
+#include <deque>
 #include <vector>
+#include <memory>
+#include <utility>
+#include <string>
+#include <atomic>
+#include <future>
 #include <exception>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
-template <class T>
-class ThreadPool
+#include <type_traits>
+#include <iterator>
+#include <algorithm>
+#include "Histogram.h"
+#include "../log/AsyncLogger.h"
+#include "../log/Logger.h"
+
+class Executor
 {
 public:
-    //懒汉模式
-    static ThreadPool<T> &create(int thread_number = 6, int max_requests = 10000)
+    //懒汉模式，max_requests为0表示队列不限长度
+    static Executor &create(int thread_number = 2, int max_requests = 10000)
     {
-        static ThreadPool<T> mInstance(thread_number, max_requests);
+        static Executor mInstance(thread_number, max_requests);
         return mInstance;
     }
 
-    //向任务队列中添加T类型任务
-    bool append(T *task);
+    //F()的返回类型
+    template <class F>
+    using result_of_t = decltype(std::declval<typename std::decay<F>::type &>()());
+
+    //提交任务，通过返回的future获取结果或者任务抛出的异常；被拒绝时返回无效的future
+    template <class F>
+    std::future<result_of_t<F>> submit(F &&func);
+
+    //提交不需要结果的任务，被拒绝时返回false
+    template <class F>
+    bool post(F &&func);
+
+    //一次加锁提交[first, last)中的所有任务，任务从迭代器中移出；队列放不下的任务对应无效的future
+    template <class It>
+    std::vector<std::future<result_of_t<typename std::iterator_traits<It>::value_type>>> submit_batch(It first, It last);
+
+    //修改队列上限（SIGHUP重新加载配置），已经在队列中的任务不受影响
+    void set_max_requests(int max_requests);
+
+    //排队时间的分位数、执行和拒绝的任务数
+    std::string report(const char *name) const;
+
+    //停止执行器：执行完队列中的任务后回收所有线程，可以重复调用
+    void stop();
 
 private:
-    //创建工作线程，并分离
-    ThreadPool(int thread_number, int max_requests);
-    ~ThreadPool();
-    void worker();
+    Executor(int thread_number, int max_requests);
+    ~Executor();
+
+    //工作线程运行的函数：在锁内取出任务，在锁外执行
+    void run();
+
+    //类型擦除后的任务，只能移动，可以保存只能移动的可调用对象
+    class Task
+    {
+    public:
+        Task() {}
+        template <class F>
+        explicit Task(F &&func) : m_impl(new Impl<typename std::decay<F>::type>(std::forward<F>(func))) {}
+        void operator()() { m_impl->run(); }
+
+    private:
+        struct Base
+        {
+            virtual void run() = 0;
+            virtual ~Base() {}
+        };
+        template <class F>
+        struct Impl : Base
+        {
+            F func;
+            explicit Impl(F &&f) : func(std::move(f)) {}
+            explicit Impl(const F &f) : func(f) {}
+            void run() override { func(); }
+        };
+        std::unique_ptr<Base> m_impl;
+    };
+
+    //任务和入队时间(微秒)
+    struct Entry
+    {
+        Task task;
+        uint64_t enqueued;
+    };
+
+    //调用时持有m_lock：队列还能放下的任务数
+    size_t room() const;
 
 private:
-    int m_thread_number;         //线程池中的线程数
-    int m_max_requests;          //请求队列中允许的最大请求数
-    std::queue<T *> m_workqueue; //任务队列
-    bool m_stop;                 //是否结束线程
-    std::mutex _lock;
-    std::condition_variable _cond;
+    std::vector<std::thread> m_threads; //工作线程，由stop()回收
+    size_t m_max_requests;              //队列上限，0表示不限
+    std::deque<Entry> m_queue;          //任务队列
+    bool m_stop;                        //是否结束线程，由m_lock保护
+    std::mutex m_lock;                  //保护任务队列
+    std::condition_variable m_cond;     //有新任务，或者已经停止
+
+    std::atomic<uint64_t> m_executed; //执行过的任务
+    std::atomic<uint64_t> m_rejected; //队列已满或者已经停止时拒绝的任务
+    Histogram m_sojourn;              //排队时间(微秒)
 };
 
-template <class T>
-ThreadPool<T>::ThreadPool(int thread_number, int max_requests) : m_thread_number(thread_number), m_max_requests(max_requests)
+Executor::Executor(int thread_number, int max_requests)
+    : m_max_requests(max_requests), m_stop(false), m_executed(0), m_rejected(0)
 {
-    m_stop = false;
-    if (thread_number <= 0 || max_requests <= 0)
+    if (thread_number <= 0 || max_requests < 0)
         throw std::exception();
-    for (int i = 0; i < m_thread_number; i++)
+    for (int i = 0; i < thread_number; i++)
     {
-        //printf("create the %dth thread\n", i);
-        LOG_INFO << "create the " << i + 1 << "th thread";
-        std::thread t(ThreadPool<T>::worker, &this);
-        t.detach();
+        LOG_INFO << "create the " << i + 1 << "th executor thread";
+        m_threads.emplace_back(&Executor::run, this);
     }
 }
 
-template <class T>
-ThreadPool<T>::~ThreadPool()
+Executor::~Executor()
 {
-    m_stop = true;
+    stop();
 }
 
-template <class T>
-bool ThreadPool<T>::append(T *task)
+void Executor::stop()
 {
-    unique_lock<std::mutex> lock(_lock);
-    while(m_workqueue.size() == m_max_requests)
     {
-        _cond.wait(lock);
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (m_stop)
+        {
+            return;
+        }
+        m_stop = true;
+    }
+    m_cond.notify_all();
+    for (std::thread &t : m_threads)
+    {
+        t.join();
     }
-    m_workqueue.push(task);
-    _cond.notify_one();
+    LOG_INFO << "executor stopped, " << (int)m_threads.size() << " threads joined";
+}
+
+size_t Executor::room() const
+{
+    if (m_stop)
+    {
+        return 0;
+    }
+    if (m_max_requests == 0)
+    {
+        return SIZE_MAX;
+    }
+    return m_queue.size() < m_max_requests ? m_max_requests - m_queue.size() : 0;
+}
+
+template <class F>
+std::future<Executor::result_of_t<F>> Executor::submit(F &&func)
+{
+    typedef result_of_t<F> R;
+    //packaged_task只能移动，把结果或者异常交给future
+    std::packaged_task<R()> task(std::forward<F>(func));
+    std::future<R> result = task.get_future();
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (room() == 0)
+        {
+            m_rejected++;
+            return std::future<R>();
+        }
+        m_queue.push_back(Entry{Task(std::move(task)), monotonic_us()});
+    }
+    m_cond.notify_one();
+    return result;
+}
+
+template <class F>
+bool Executor::post(F &&func)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (room() == 0)
+        {
+            m_rejected++;
+            return false;
+        }
+        m_queue.push_back(Entry{Task(std::forward<F>(func)), monotonic_us()});
+    }
+    m_cond.notify_one();
     return true;
 }
 
-template <class T>
-void ThreadPool<T>::worker()
+template <class It>
+std::vector<std::future<Executor::result_of_t<typename std::iterator_traits<It>::value_type>>> Executor::submit_batch(It first, It last)
+{
+    typedef result_of_t<typename std::iterator_traits<It>::value_type> R;
+    //在锁外准备好所有任务，锁内只做入队
+    std::vector<std::packaged_task<R()>> tasks;
+    std::vector<std::future<R>> results;
+    for (; first != last; ++first)
+    {
+        tasks.emplace_back(std::move(*first));
+        results.push_back(tasks.back().get_future());
+    }
+    size_t accepted;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        accepted = std::min(room(), tasks.size());
+        uint64_t now = monotonic_us();
+        for (size_t i = 0; i < accepted; i++)
+        {
+            m_queue.push_back(Entry{Task(std::move(tasks[i])), now});
+        }
+    }
+    //放不下的任务：对应的future置为无效
+    for (size_t i = accepted; i < results.size(); i++)
+    {
+        results[i] = std::future<R>();
+    }
+    m_rejected += results.size() - accepted;
+    if (accepted == 1)
+        m_cond.notify_one();
+    else if (accepted > 1)
+        m_cond.notify_all();
+    return results;
+}
+
+void Executor::set_max_requests(int max_requests)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_max_requests = max_requests;
+}
+
+std::string Executor::report(const char *name) const
+{
+    std::string out = m_sojourn.summary(name, "us");
+    char buf[128];
+    snprintf(buf, sizeof(buf), " executed=%llu rejected=%llu", (unsigned long long)m_executed.load(),
+             (unsigned long long)m_rejected.load());
+    return out + buf;
+}
+
+void Executor::run()
 {
-    while (!m_stop)
+    while (true)
     {
-        unique_lock<std::mutex> lock(_lock);
-        while(m_workqueue.empty())
+        Entry entry;
         {
-            _cond.wait();
+            std::unique_lock<std::mutex> lock(m_lock);
+            m_cond.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+            //已经停止，并且队列中的任务都已经执行完
+            if (m_queue.empty())
+            {
+                return;
+            }
+            entry = std::move(m_queue.front());
+            m_queue.pop_front();
         }
-        T *task = m_workqueue.front();
-        m_workqueue.pop();
-        _cond.notify_all();
-        //执行任务
-        task->process();
+        m_sojourn.record(monotonic_us() - entry.enqueued);
+        //执行任务，任务的异常由packaged_task交给future，post()的任务不应该抛出异常
+        entry.task();
+        m_executed++;
     }
 }
 
-#endif // THREADPOOL_H
\ No newline at end of file
+#endif // THREADPOOL2_H
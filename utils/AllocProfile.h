@@ -0,0 +1,192 @@
+/**
+ * @author: fenghaze
+ * @date: 2026/10/19 23:50
+ * @desc: 内存分配统计，编译时定义ALLOC_PROFILE才生效（cmake -DALLOC_PROFILE=ON）
+ * 替换全局的operator new/delete：统计分配次数和字节数，并按调用点(operator new的返回地址)分别计数
+ * 调用点表是固定大小的开放寻址哈希表，只用原子操作，不加锁、不分配内存，表满之后的调用点计入overflow
+ * report()输出距上次调用以来每个请求的分配次数，以及分配最多的调用点（函数名需要链接时加-rdynamic，
+ * 否则只有可执行文件内的偏移，可以用addr2line -e查看）
+ * 只统计operator new，直接调用malloc的C代码不在其中
+ * 这个文件定义了全局的operator new，只能被一个源文件包含（main.cpp）
+ */
+
+#ifndef ALLOCPROFILE_H
+#define ALLOCPROFILE_H
+
+#ifdef ALLOC_PROFILE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <dlfcn.h>
+#include <cxxabi.h>
+#include <atomic>
+#include <new>
+#include <string>
+#include <algorithm>
+
+class AllocProfile
+{
+public:
+    static AllocProfile &instance()
+    {
+        static AllocProfile mInstance;
+        return mInstance;
+    }
+
+    //operator new调用：site是调用operator new的返回地址
+    void record(void *site, size_t size);
+
+    uint64_t allocations() const { return m_allocs.load(std::memory_order_relaxed); }
+
+    //requests为到目前为止完成的请求数，输出两次调用之间每个请求的分配次数和分配最多的top个调用点
+    std::string report(uint64_t requests, int top = 8);
+
+private:
+    AllocProfile() : m_allocs(0), m_bytes(0), m_overflow(0), m_last_allocs(0), m_last_requests(0) {}
+
+    static const int SITES = 4096; //2的幂
+    struct Site
+    {
+        std::atomic<uintptr_t> addr;
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> bytes;
+        uint64_t last; //上次report()时的count，只由report()访问
+    };
+
+    //地址对应的函数名和偏移
+    static std::string symbol(uintptr_t addr);
+
+private:
+    std::atomic<uint64_t> m_allocs;
+    std::atomic<uint64_t> m_bytes;
+    std::atomic<uint64_t> m_overflow; //调用点表已满时的分配
+    uint64_t m_last_allocs;           //上次report()时的分配次数
+    uint64_t m_last_requests;         //上次report()时的请求数
+    Site m_sites[SITES];              //静态存储，原子变量为零初始化
+};
+
+void AllocProfile::record(void *site, size_t size)
+{
+    m_allocs.fetch_add(1, std::memory_order_relaxed);
+    m_bytes.fetch_add(size, std::memory_order_relaxed);
+    uintptr_t addr = (uintptr_t)site;
+    size_t idx = (addr >> 4) * 0x9E3779B97F4A7C15ULL >> 52; //取乘积的高12位
+    for (int probe = 0; probe < 64; probe++)
+    {
+        Site &s = m_sites[(idx + probe) & (SITES - 1)];
+        uintptr_t cur = s.addr.load(std::memory_order_relaxed);
+        if (cur == 0 && s.addr.compare_exchange_strong(cur, addr, std::memory_order_relaxed))
+        {
+            cur = addr;
+        }
+        if (cur == addr)
+        {
+            s.count.fetch_add(1, std::memory_order_relaxed);
+            s.bytes.fetch_add(size, std::memory_order_relaxed);
+            return;
+        }
+    }
+    m_overflow.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::string AllocProfile::symbol(uintptr_t addr)
+{
+    char buf[512];
+    Dl_info info;
+    if (dladdr((void *)addr, &info) == 0)
+    {
+        snprintf(buf, sizeof(buf), "%#lx", (unsigned long)addr);
+        return buf;
+    }
+    if (!info.dli_sname)
+    {
+        //没有导出的符号：输出模块内的偏移，用addr2line -e <模块> <偏移>查看
+        snprintf(buf, sizeof(buf), "%s+%#lx", info.dli_fname, (unsigned long)(addr - (uintptr_t)info.dli_fbase));
+        return buf;
+    }
+    int status;
+    char *demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+    snprintf(buf, sizeof(buf), "%.400s+%#lx", status == 0 ? demangled : info.dli_sname,
+             (unsigned long)(addr - (uintptr_t)info.dli_saddr));
+    free(demangled);
+    return buf;
+}
+
+std::string AllocProfile::report(uint64_t requests, int top)
+{
+    uint64_t allocs = allocations();
+    uint64_t da = allocs - m_last_allocs, dr = requests - m_last_requests;
+    m_last_allocs = allocs;
+    m_last_requests = requests;
+    char buf[256];
+    snprintf(buf, sizeof(buf), "alloc: total=%llu bytes=%llu overflow=%llu since_last=%llu requests=%llu per_request=%.3f",
+             (unsigned long long)allocs, (unsigned long long)m_bytes.load(), (unsigned long long)m_overflow.load(),
+             (unsigned long long)da, (unsigned long long)dr, dr ? (double)da / dr : 0.0);
+    std::string out = buf;
+
+    //按距上次report()的分配次数排序，只输出前top个
+    int order[SITES];
+    uint64_t delta[SITES];
+    int n = 0;
+    for (int i = 0; i < SITES; i++)
+    {
+        Site &s = m_sites[i];
+        uint64_t count = s.count.load(std::memory_order_relaxed);
+        delta[i] = count - s.last;
+        s.last = count;
+        if (s.addr.load(std::memory_order_relaxed) && delta[i])
+            order[n++] = i;
+    }
+    std::sort(order, order + n, [&](int a, int b) { return delta[a] > delta[b]; });
+    for (int k = 0; k < n && k < top; k++)
+    {
+        Site &s = m_sites[order[k]];
+        snprintf(buf, sizeof(buf), "\n  %10llu %8.3f/req  ", (unsigned long long)delta[order[k]], dr ? (double)delta[order[k]] / dr : 0.0);
+        out += buf + symbol(s.addr.load(std::memory_order_relaxed));
+    }
+    return out;
+}
+
+//替换全局的operator new/delete，其他形式(nothrow、数组、对齐)由标准库转发到这两个函数
+void *operator new(size_t size)
+{
+    AllocProfile::instance().record(__builtin_return_address(0), size);
+    void *p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    AllocProfile::instance().record(__builtin_return_address(0), size);
+    void *p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+    free(p);
+}
+
+#endif // ALLOC_PROFILE
+
+#endif // ALLOCPROFILE_H
@@ -0,0 +1,326 @@
+/**
+ * @author: fenghaze
+ * @date: 2026/10/19 21:20
+ * @desc: 运行时配置：默认值 → 配置文件 → 命令行参数，后面的覆盖前面的
+ * 配置文件每行一项 "key = value"，#之后是注释；命令行使用 --key=value，--config=路径 指定配置文件
+ * 每一项在注册时给出默认值、取值范围和是否可以热加载，启动时所有值都必须合法，否则拒绝启动
+ * SIGHUP时调用reload()：重新读取配置文件，只更新可以热加载的项，其余项的修改需要重启（或热升级）才生效
+ * 和Listener.h一样只依赖系统头文件，threadpool和processpool共用
+ */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <map>
+
+class Config
+{
+public:
+    static Config &instance()
+    {
+        static Config mInstance;
+        return mInstance;
+    }
+
+    //注册整数项，[min, max]之外的值在加载时报错；开关用[0, 1]，可以写成on/off、true/false、yes/no
+    void add_int(const char *key, int def, int min, int max, bool reloadable, const char *desc);
+
+    //注册字符串项，choices不为空时只允许其中的值，用'|'分隔，例如"info|warn|error"
+    void add_string(const char *key, const char *def, bool reloadable, const char *desc, const char *choices = nullptr);
+
+    //启动时调用一次：解析命令行，读取--config指定的文件，再应用命令行的其他项
+    //出错时返回false，err中是错误原因；--help时输出所有配置项并返回false，err为空
+    bool load(int argc, const char *argv[], std::string &err);
+
+    //重新读取配置文件和启动时的命令行，只更新可以热加载的项；changed中是实际改变的项
+    //任何一项不合法时不做任何修改，返回false
+    bool reload(std::string &err, std::vector<std::string> &changed);
+
+    int get_int(const char *key) const;
+    const std::string &get_string(const char *key) const;
+
+    //当前所有配置项，格式和配置文件相同，可以直接保存为配置文件
+    std::string dump() const;
+
+private:
+    Config() {}
+
+    struct Entry
+    {
+        bool is_int;
+        int ival, min, max;
+        std::string sval;
+        std::string choices;
+        bool reloadable;
+        std::string desc;
+    };
+
+    //把value解析到entry中，失败时返回false
+    static bool parse_value(const std::string &key, Entry &entry, const std::string &value, std::string &err);
+
+    //从默认值开始，依次应用配置文件和命令行，结果写到values中
+    bool build(std::map<std::string, Entry> &values, std::string &err) const;
+
+    //读取配置文件的每一项，应用到values中
+    bool read_file(const std::string &path, std::map<std::string, Entry> &values, std::string &err) const;
+
+    static std::string trim(const std::string &s);
+
+private:
+    std::map<std::string, Entry> m_defaults; //注册时的默认值
+    std::map<std::string, Entry> m_values;   //当前生效的值
+    std::vector<std::string> m_order;        //注册的顺序，dump()按这个顺序输出
+    std::string m_path;                      //配置文件路径，为空表示没有配置文件
+    std::vector<std::pair<std::string, std::string>> m_cli; //命令行中的key=value
+};
+
+void Config::add_int(const char *key, int def, int min, int max, bool reloadable, const char *desc)
+{
+    Entry &e = m_defaults[key];
+    e.is_int = true;
+    e.ival = def;
+    e.min = min;
+    e.max = max;
+    e.reloadable = reloadable;
+    e.desc = desc;
+    m_values[key] = e;
+    m_order.push_back(key);
+}
+
+void Config::add_string(const char *key, const char *def, bool reloadable, const char *desc, const char *choices)
+{
+    Entry &e = m_defaults[key];
+    e.is_int = false;
+    e.ival = e.min = e.max = 0;
+    e.sval = def;
+    e.choices = choices ? choices : "";
+    e.reloadable = reloadable;
+    e.desc = desc;
+    m_values[key] = e;
+    m_order.push_back(key);
+}
+
+bool Config::load(int argc, const char *argv[], std::string &err)
+{
+    m_cli.clear();
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0)
+        {
+            fputs(dump().c_str(), stdout);
+            err.clear();
+            return false;
+        }
+        if (strncmp(arg, "--", 2) != 0 || !strchr(arg, '='))
+        {
+            err = std::string("invalid argument '") + arg + "', expected --key=value";
+            return false;
+        }
+        std::string kv(arg + 2);
+        size_t eq = kv.find('=');
+        std::string key = kv.substr(0, eq), value = kv.substr(eq + 1);
+        //命令行中的key可以用'-'代替'_'
+        for (char &c : key)
+        {
+            if (c == '-')
+                c = '_';
+        }
+        if (key == "config")
+            m_path = value;
+        else
+            m_cli.push_back(std::make_pair(key, value));
+    }
+    std::map<std::string, Entry> values;
+    if (!build(values, err))
+    {
+        return false;
+    }
+    m_values.swap(values);
+    return true;
+}
+
+bool Config::reload(std::string &err, std::vector<std::string> &changed)
+{
+    std::map<std::string, Entry> values;
+    if (!build(values, err))
+    {
+        return false;
+    }
+    changed.clear();
+    for (const std::string &key : m_order)
+    {
+        Entry &cur = m_values[key];
+        const Entry &next = values[key];
+        if (cur.ival == next.ival && cur.sval == next.sval)
+        {
+            continue;
+        }
+        if (!cur.reloadable)
+        {
+            fprintf(stderr, "config: '%s' changed but only takes effect after a restart\n", key.c_str());
+            continue;
+        }
+        cur = next;
+        changed.push_back(key);
+    }
+    return true;
+}
+
+int Config::get_int(const char *key) const
+{
+    auto it = m_values.find(key);
+    assert(it != m_values.end() && it->second.is_int);
+    return it->second.ival;
+}
+
+const std::string &Config::get_string(const char *key) const
+{
+    auto it = m_values.find(key);
+    assert(it != m_values.end() && !it->second.is_int);
+    return it->second.sval;
+}
+
+std::string Config::dump() const
+{
+    std::string out;
+    for (const std::string &key : m_order)
+    {
+        const Entry &e = m_values.find(key)->second;
+        out += "# " + e.desc;
+        if (e.is_int)
+            out += " [" + std::to_string(e.min) + ", " + std::to_string(e.max) + "]";
+        else if (!e.choices.empty())
+            out += " [" + e.choices + "]";
+        if (e.reloadable)
+            out += " (SIGHUP)";
+        out += "\n" + key + " = " + (e.is_int ? std::to_string(e.ival) : e.sval) + "\n";
+    }
+    return out;
+}
+
+bool Config::parse_value(const std::string &key, Entry &entry, const std::string &value, std::string &err)
+{
+    if (!entry.is_int)
+    {
+        if (!entry.choices.empty() && ("|" + entry.choices + "|").find("|" + value + "|") == std::string::npos)
+        {
+            err = "config: " + key + " must be one of " + entry.choices + ", got '" + value + "'";
+            return false;
+        }
+        entry.sval = value;
+        return true;
+    }
+    long v;
+    if (entry.min == 0 && entry.max == 1 && (value == "on" || value == "true" || value == "yes"))
+        v = 1;
+    else if (entry.min == 0 && entry.max == 1 && (value == "off" || value == "false" || value == "no"))
+        v = 0;
+    else
+    {
+        char *end;
+        errno = 0;
+        v = strtol(value.c_str(), &end, 10);
+        if (value.empty() || *end != '\0' || errno == ERANGE)
+        {
+            err = "config: " + key + " expects an integer, got '" + value + "'";
+            return false;
+        }
+    }
+    if (v < entry.min || v > entry.max)
+    {
+        err = "config: " + key + " = " + value + " is out of range [" + std::to_string(entry.min) + ", " + std::to_string(entry.max) + "]";
+        return false;
+    }
+    entry.ival = (int)v;
+    return true;
+}
+
+bool Config::build(std::map<std::string, Entry> &values, std::string &err) const
+{
+    values = m_defaults;
+    if (!m_path.empty() && !read_file(m_path, values, err))
+    {
+        return false;
+    }
+    for (const auto &kv : m_cli)
+    {
+        auto it = values.find(kv.first);
+        if (it == values.end())
+        {
+            err = "config: unknown option --" + kv.first;
+            return false;
+        }
+        if (!parse_value(kv.first, it->second, kv.second, err))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Config::read_file(const std::string &path, std::map<std::string, Entry> &values, std::string &err) const
+{
+    FILE *fp = fopen(path.c_str(), "r");
+    if (!fp)
+    {
+        err = "config: cannot open " + path + ": " + strerror(errno);
+        return false;
+    }
+    char buf[1024];
+    int lineno = 0;
+    bool ok = true;
+    while (ok && fgets(buf, sizeof(buf), fp))
+    {
+        ++lineno;
+        std::string line(buf);
+        size_t hash = line.find('#');
+        if (hash != std::string::npos)
+        {
+            line.erase(hash);
+        }
+        line = trim(line);
+        if (line.empty())
+        {
+            continue;
+        }
+        size_t eq = line.find('=');
+        std::string key = eq == std::string::npos ? line : trim(line.substr(0, eq));
+        auto it = values.find(key);
+        if (eq == std::string::npos || it == values.end())
+        {
+            err = "config: " + path + ":" + std::to_string(lineno) + ": " + (eq == std::string::npos ? "expected key = value" : "unknown key '" + key + "'");
+            ok = false;
+            break;
+        }
+        if (!parse_value(key, it->second, trim(line.substr(eq + 1)), err))
+        {
+            err += " (" + path + ":" + std::to_string(lineno) + ")";
+            ok = false;
+        }
+    }
+    fclose(fp);
+    return ok;
+}
+
+std::string Config::trim(const std::string &s)
+{
+    size_t b = s.find_first_not_of(" \t\r\n");
+    if (b == std::string::npos)
+    {
+        return "";
+    }
+    size_t e = s.find_last_not_of(" \t\r\n");
+    return s.substr(b, e - b + 1);
+}
+
+#endif // CONFIG_H
@@ -0,0 +1,138 @@
+/**
+ * @author: fenghaze
+ * @date: 2026/10/19 20:45
+ * @desc: 监听socket的配置，threadpool和processpool共用
+ * backlog：listen()的队列长度，实际上限还受net.core.somaxconn限制
+ * TCP_DEFER_ACCEPT：客户端发来请求数据后才唤醒accept，只建立连接不发请求的客户不占用连接对象
+ * TCP_FASTOPEN：回访的客户端可以在SYN中携带请求，节省一个RTT，需要net.ipv4.tcp_fastopen打开服务端位(2)
+ * TCP_NODELAY设置在监听socket上，accept的连接会继承；TCP_QUICKACK不会保留，只能对每个连接单独设置
+ * 这个文件只依赖系统头文件，不和两个目录下同名的utils.h冲突
+ */
+
+#ifndef LISTENER_H
+#define LISTENER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+struct ListenOptions
+{
+    int backlog;      //listen()的backlog
+    int defer_accept; //TCP_DEFER_ACCEPT的秒数，0表示关闭
+    int fastopen;     //TCP_FASTOPEN的队列长度，0表示关闭
+    bool nodelay;     //accept的连接关闭Nagle算法
+    bool quickack;    //accept的连接立即确认第一个请求
+
+    ListenOptions() : backlog(1024), defer_accept(1), fastopen(256), nodelay(true), quickack(false) {}
+};
+
+class Listener
+{
+public:
+    static Listener &instance()
+    {
+        static Listener mInstance;
+        return mInstance;
+    }
+
+    //必须在open()/adopt()之前修改，只有quickack可以在之后修改
+    ListenOptions &options() { return m_options; }
+
+    //创建、配置、绑定并监听ip:port，失败时返回-1
+    int open(const char *ip, int port);
+
+    //继承的监听socket（热升级）：按当前配置重新设置选项和backlog
+    bool adopt(int lfd);
+
+    //accept之后对每个连接调用，只设置不能从监听socket继承的选项
+    void tune(int cfd) const
+    {
+        if (m_options.quickack)
+        {
+            int val = 1;
+            setsockopt(cfd, IPPROTO_TCP, TCP_QUICKACK, &val, sizeof(val));
+        }
+    }
+
+private:
+    Listener() {}
+
+    //设置监听socket的TCP选项，某个选项不被支持时只输出警告
+    void apply(int lfd);
+
+private:
+    ListenOptions m_options;
+};
+
+int Listener::open(const char *ip, int port)
+{
+    int lfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (lfd < 0)
+    {
+        perror("socket()");
+        return -1;
+    }
+    struct sockaddr_in laddr;
+    memset(&laddr, 0, sizeof(laddr));
+    laddr.sin_family = AF_INET;
+    laddr.sin_port = htons(port);
+    inet_pton(AF_INET, ip, &laddr.sin_addr);
+    int val = 1;
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+    apply(lfd);
+    if (bind(lfd, (struct sockaddr *)&laddr, sizeof(laddr)) < 0 || listen(lfd, m_options.backlog) < 0)
+    {
+        perror("bind()/listen()");
+        close(lfd);
+        return -1;
+    }
+    return lfd;
+}
+
+bool Listener::adopt(int lfd)
+{
+    apply(lfd);
+    //对已经在监听的socket再次调用listen()只修改backlog
+    if (listen(lfd, m_options.backlog) < 0)
+    {
+        perror("listen()");
+        return false;
+    }
+    return true;
+}
+
+void Listener::apply(int lfd)
+{
+    //backlog超过somaxconn时内核会静默截断
+    FILE *fp = fopen("/proc/sys/net/core/somaxconn", "r");
+    if (fp)
+    {
+        int somaxconn = 0;
+        if (fscanf(fp, "%d", &somaxconn) == 1 && somaxconn < m_options.backlog)
+        {
+            fprintf(stderr, "listen backlog %d is capped by net.core.somaxconn=%d\n", m_options.backlog, somaxconn);
+        }
+        fclose(fp);
+    }
+    int val = m_options.defer_accept;
+    if (setsockopt(lfd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &val, sizeof(val)) < 0)
+    {
+        perror("setsockopt(TCP_DEFER_ACCEPT)");
+    }
+    val = m_options.fastopen;
+    if (val > 0 && setsockopt(lfd, IPPROTO_TCP, TCP_FASTOPEN, &val, sizeof(val)) < 0)
+    {
+        perror("setsockopt(TCP_FASTOPEN)");
+    }
+    val = m_options.nodelay ? 1 : 0;
+    setsockopt(lfd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+}
+
+#endif // LISTENER_H